@@ -1,3 +1,5 @@
+#pragma once
+
 #include <linux/i2c-dev.h>
 #include <linux/i2c.h>
 #include <linux/types.h>
@@ -5,6 +7,8 @@
 
 #define I2C_DATA_MAX 256
 
+/* An I2C_M_RECV_LEN read takes rx_buf[0] as the number of bytes read after
+ * the block: 1 for the length byte, 2 to also read the PEC byte */
 static inline __s32 i2c_read_after_write(int file,
                                          __u8 slave_addr, __u8 tx_len,
                                          __u8* tx_buf, int rx_len, __u8* rx_buf)
@@ -33,3 +37,14 @@ static inline __s32 i2c_read_after_write(int file,
 
     return ret;
 }
+
+/* Run up to I2C_RDWR_IOCTL_MAX_MSGS messages in one combined transfer */
+static inline __s32 i2c_rdwr(int file, struct i2c_msg* msgs, int nmsgs)
+{
+    struct i2c_rdwr_ioctl_data msgst;
+
+    msgst.msgs = msgs;
+    msgst.nmsgs = nmsgs;
+
+    return ioctl(file, I2C_RDWR, &msgst);
+}
@@ -0,0 +1,347 @@
+#include "i2c_trace.hpp"
+
+#include "nvme_log.hpp"
+
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iterator>
+#include <thread>
+
+#include "i2c.h"
+
+namespace phosphor
+{
+namespace smbus
+{
+
+using phosphor::nvme::logError;
+
+static constexpr const char traceMagic[4] = {'N', 'V', 'M', 'T'};
+static constexpr uint8_t traceVersion = 1;
+
+/* Size of a record without its tx and rx bytes */
+static constexpr size_t recordHeaderSize = 1 + 8 + 1 + 1 + 4 + 4 + 2 + 2;
+
+I2cTrace& I2cTrace::get()
+{
+    static I2cTrace trace;
+    return trace;
+}
+
+template <typename T>
+static void putField(std::string& buf, T value)
+{
+    buf.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+static T readField(const std::string& buf, size_t& offset)
+{
+    T value;
+    memcpy(&value, buf.data() + offset, sizeof(value));
+    offset += sizeof(value);
+    return value;
+}
+
+bool I2cTrace::startRecording(const std::string& path)
+{
+    // A new trace replaces the one recorded before.
+    file.close();
+    file.clear();
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    file.write(traceMagic, sizeof(traceMagic));
+    file.put(static_cast<char>(traceVersion));
+
+    start = std::chrono::steady_clock::now();
+    traceMode = Mode::Record;
+
+    return true;
+}
+
+bool I2cTrace::startReplay(const std::string& path, double speed)
+{
+    std::ifstream input(path, std::ios::binary);
+    if (!input.is_open())
+    {
+        return false;
+    }
+
+    std::string buf((std::istreambuf_iterator<char>(input)),
+                    std::istreambuf_iterator<char>());
+
+    // A new trace replaces the accesses left from the one replayed before.
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        replay.clear();
+        remaining = 0;
+        taken = 0;
+    }
+
+    size_t offset = sizeof(traceMagic) + 1;
+    if (buf.size() < offset ||
+        buf.compare(0, sizeof(traceMagic), traceMagic, sizeof(traceMagic)) !=
+            0 ||
+        static_cast<uint8_t>(buf[sizeof(traceMagic)]) != traceVersion)
+    {
+        return false;
+    }
+
+    while (offset + recordHeaderSize <= buf.size())
+    {
+        Record record;
+
+        record.kind = static_cast<Kind>(readField<uint8_t>(buf, offset));
+        record.timestamp = readField<uint64_t>(buf, offset);
+        record.bus = readField<uint8_t>(buf, offset);
+        record.address = readField<uint8_t>(buf, offset);
+        record.result = readField<int32_t>(buf, offset);
+        record.latency = readField<uint32_t>(buf, offset);
+        auto txLen = readField<uint16_t>(buf, offset);
+        auto rxLen = readField<uint16_t>(buf, offset);
+
+        if (offset + txLen + rxLen > buf.size())
+        {
+            break;
+        }
+
+        // A record longer than any transaction is damaged, replaying it
+        // would overrun the response buffers.
+        if (txLen > UINT8_MAX || rxLen > I2C_DATA_MAX)
+        {
+            logError("i2c-trace-record", "I2C trace record too long, skipped",
+                     {{"TRACE_PATH", path},
+                      {"TX_LEN", std::to_string(txLen)},
+                      {"RX_LEN", std::to_string(rxLen)}});
+            offset += txLen + rxLen;
+            continue;
+        }
+
+        record.tx.assign(buf.begin() + offset, buf.begin() + offset + txLen);
+        offset += txLen;
+        record.rx.assign(buf.begin() + offset, buf.begin() + offset + rxLen);
+        offset += rxLen;
+
+        std::string key;
+        keyOf(record.kind, record.bus, record.address, record.tx.data(),
+              record.tx.size(), key);
+        replay[key].push_back(std::move(record));
+        ++remaining;
+    }
+
+    if (offset != buf.size())
+    {
+        logError("i2c-trace", "I2C trace is truncated",
+                 {{"TRACE_PATH", path}});
+    }
+
+    replaySpeed = speed;
+    traceMode = Mode::Replay;
+
+    return true;
+}
+
+uint64_t I2cTrace::elapsed() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+bool I2cTrace::exhausted() const
+{
+    return traceMode == Mode::Replay && unmatched() == 0;
+}
+
+size_t I2cTrace::replayed() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return taken;
+}
+
+size_t I2cTrace::unmatched() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return remaining;
+}
+
+void I2cTrace::keyOf(Kind kind, uint8_t bus, uint8_t address,
+                     const uint8_t* data, size_t len, std::string& key)
+{
+    key.clear();
+    key.push_back(static_cast<char>(kind));
+    key.push_back(static_cast<char>(bus));
+    key.push_back(static_cast<char>(address));
+    if (len)
+    {
+        key.append(reinterpret_cast<const char*>(data), len);
+    }
+}
+
+void I2cTrace::write(const Record& record)
+{
+    std::string buf;
+
+    putField<uint8_t>(buf, static_cast<uint8_t>(record.kind));
+    putField<uint64_t>(buf, record.timestamp);
+    putField<uint8_t>(buf, record.bus);
+    putField<uint8_t>(buf, record.address);
+    putField<int32_t>(buf, record.result);
+    putField<uint32_t>(buf, record.latency);
+    putField<uint16_t>(buf, record.tx.size());
+    putField<uint16_t>(buf, record.rx.size());
+    buf.append(record.tx.begin(), record.tx.end());
+    buf.append(record.rx.begin(), record.rx.end());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    file.write(buf.data(), buf.size());
+}
+
+bool I2cTrace::take(Kind kind, uint8_t bus, uint8_t address,
+                    const uint8_t* data, size_t len, Record& record)
+{
+    // The key buffer of each thread is reused, so that a replayed poll
+    // cycle allocates no more than a live one.
+    thread_local std::string key;
+    keyOf(kind, bus, address, data, len, key);
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto iter = replay.find(key);
+    if (iter == replay.end() || iter->second.empty())
+    {
+        return false;
+    }
+
+    record = std::move(iter->second.front());
+    iter->second.pop_front();
+    --remaining;
+    ++taken;
+
+    return true;
+}
+
+void I2cTrace::recordTransfer(int bus, uint8_t address, const uint8_t* tx,
+                              uint8_t txLen, const uint8_t* rx, uint16_t rxLen,
+                              int result, std::chrono::microseconds latency)
+{
+    Record record;
+
+    record.kind = Kind::Transfer;
+    record.timestamp = elapsed();
+    record.bus = bus;
+    record.address = address;
+    record.result = result;
+    record.latency = latency.count();
+    record.tx.assign(tx, tx + txLen);
+    if (result >= 0)
+    {
+        record.rx.assign(rx, rx + rxLen);
+    }
+
+    write(record);
+}
+
+int I2cTrace::replayTransfer(int bus, uint8_t address, const uint8_t* tx,
+                             uint8_t txLen, uint8_t* rx)
+{
+    Record record;
+
+    if (!take(Kind::Transfer, bus, address, tx, txLen, record))
+    {
+        logError("i2c-trace-" + std::to_string(bus),
+                 "I2C transaction missing from trace",
+                 {{"I2C_BUS", std::to_string(bus)},
+                  {"I2C_ADDRESS", std::to_string(address)}});
+        rx[0] = 0;
+        errno = ENXIO;
+        return -1;
+    }
+
+    if (replaySpeed > 0)
+    {
+        std::this_thread::sleep_for(std::chrono::duration<double, std::micro>(
+            record.latency / replaySpeed));
+    }
+
+    memcpy(rx, record.rx.data(),
+           std::min<size_t>(record.rx.size(), I2C_DATA_MAX));
+    if (record.result < 0)
+    {
+        rx[0] = 0;
+        errno = EIO;
+    }
+
+    return record.result;
+}
+
+void I2cTrace::recordOpen(int bus, int result)
+{
+    Record record{Kind::Open, 0, static_cast<uint8_t>(bus), 0, result, 0,
+                  {}, {}};
+
+    record.timestamp = elapsed();
+
+    write(record);
+}
+
+int I2cTrace::replayOpen(int bus)
+{
+    Record record;
+
+    if (!take(Kind::Open, bus, 0, nullptr, 0, record))
+    {
+        return -1;
+    }
+
+    return record.result;
+}
+
+void I2cTrace::recordGpio(const std::string& path, const std::string& value)
+{
+    Record record{Kind::Gpio,
+                  0,
+                  0,
+                  0,
+                  0,
+                  0,
+                  std::vector<uint8_t>(path.begin(), path.end()),
+                  std::vector<uint8_t>(value.begin(), value.end())};
+
+    record.timestamp = elapsed();
+
+    write(record);
+}
+
+std::string I2cTrace::replayGpio(const std::string& path)
+{
+    Record record;
+
+    if (!take(Kind::Gpio, 0, 0, reinterpret_cast<const uint8_t*>(path.data()),
+              path.size(), record))
+    {
+        return std::string();
+    }
+
+    return std::string(record.rx.begin(), record.rx.end());
+}
+
+void I2cTrace::flush()
+{
+    if (traceMode != Mode::Record)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    file.flush();
+}
+
+} // namespace smbus
+} // namespace phosphor
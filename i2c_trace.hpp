@@ -0,0 +1,181 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace phosphor
+{
+namespace smbus
+{
+
+/** @class I2cTrace
+ *  @brief Records the hardware accesses of the daemon to a binary trace,
+ *         or replays them from one instead of touching the hardware.
+ *
+ *  The trace holds every I2C transaction (timestamp, bus, address, tx and
+ *  rx bytes, result and latency), every I2C bus open and every GPIO read,
+ *  so that a replay drives the whole poll pipeline exactly as recorded.
+ */
+class I2cTrace
+{
+  public:
+    I2cTrace(const I2cTrace&) = delete;
+    I2cTrace& operator=(const I2cTrace&) = delete;
+    I2cTrace(I2cTrace&&) = delete;
+    I2cTrace& operator=(I2cTrace&&) = delete;
+
+    enum class Mode
+    {
+        Off,
+        Record,
+        Replay,
+    };
+
+    /** @brief Get the process wide trace */
+    static I2cTrace& get();
+
+    /** @brief Record all hardware accesses to a trace file, closing the
+     *         one recorded before
+     *
+     * @param[in] path - Trace file to create
+     *
+     * @return Whether the trace file could be created
+     */
+    bool startRecording(const std::string& path);
+
+    /** @brief Replay the hardware accesses from a trace file, dropping
+     *         the ones left from the trace replayed before
+     *
+     * @param[in] path  - Trace file to replay
+     * @param[in] speed - Replay speed factor, 1 is real time and 0 replays
+     *                    as fast as possible
+     *
+     * @return Whether the trace file could be loaded
+     */
+    bool startReplay(const std::string& path, double speed);
+
+    /** @brief Current mode */
+    Mode mode() const
+    {
+        return traceMode;
+    }
+
+    /** @brief Replay speed factor */
+    double speed() const
+    {
+        return replaySpeed;
+    }
+
+    /** @brief Whether every replayed access has been consumed */
+    bool exhausted() const;
+
+    /** @brief Number of recorded accesses replayed so far */
+    size_t replayed() const;
+
+    /** @brief Number of recorded accesses not replayed yet */
+    size_t unmatched() const;
+
+    /** @brief Record an I2C transaction */
+    void recordTransfer(int bus, uint8_t address, const uint8_t* tx,
+                        uint8_t txLen, const uint8_t* rx, uint16_t rxLen,
+                        int result,
+                        std::chrono::microseconds latency);
+
+    /** @brief Replay an I2C transaction
+     *
+     * @param[in]  bus     - I2C bus number
+     * @param[in]  address - I2C slave address
+     * @param[in]  tx      - Bytes written
+     * @param[in]  txLen   - Number of bytes written
+     * @param[out] rx      - Recorded block read response, I2C_DATA_MAX bytes
+     *
+     * @return Recorded result, -1 if the trace has no such transaction
+     */
+    int replayTransfer(int bus, uint8_t address, const uint8_t* tx,
+                       uint8_t txLen, uint8_t* rx);
+
+    /** @brief Record the result of opening an I2C bus */
+    void recordOpen(int bus, int result);
+
+    /** @brief Replay the result of opening an I2C bus */
+    int replayOpen(int bus);
+
+    /** @brief Record a GPIO value read */
+    void recordGpio(const std::string& path, const std::string& value);
+
+    /** @brief Replay a GPIO value read */
+    std::string replayGpio(const std::string& path);
+
+    /** @brief Write buffered records to the trace file */
+    void flush();
+
+  private:
+    I2cTrace() = default;
+
+    enum class Kind : uint8_t
+    {
+        Transfer = 1,
+        Open = 2,
+        Gpio = 3,
+    };
+
+    /**
+     * Structure for keeping one trace record
+     */
+    struct Record
+    {
+        Kind kind;
+        uint64_t timestamp; /* Nanoseconds since the start of the trace  */
+        uint8_t bus;
+        uint8_t address;
+        int32_t result;
+        uint32_t latency; /* Microseconds  */
+        std::vector<uint8_t> tx;
+        std::vector<uint8_t> rx;
+    };
+
+    /** @brief Append a record to the trace file */
+    void write(const Record& record);
+
+    /** @brief Take the next recorded access with a key
+     *
+     * @param[in]  kind    - Access kind
+     * @param[in]  bus     - I2C bus number
+     * @param[in]  address - I2C slave address
+     * @param[in]  data    - Bytes written, or GPIO path
+     * @param[in]  len     - Number of bytes of data
+     * @param[out] record  - Recorded access
+     *
+     * @return Whether the trace held such an access
+     */
+    bool take(Kind kind, uint8_t bus, uint8_t address, const uint8_t* data,
+              size_t len, Record& record);
+
+    /** @brief Nanoseconds since the start of the recording */
+    uint64_t elapsed() const;
+
+    /** @brief Build the replay lookup key of an access into key */
+    static void keyOf(Kind kind, uint8_t bus, uint8_t address,
+                      const uint8_t* data, size_t len, std::string& key);
+
+    Mode traceMode = Mode::Off;
+    double replaySpeed = 1;
+    std::chrono::steady_clock::time_point start;
+    std::ofstream file;
+    mutable std::mutex mutex;
+    /** @brief Recorded accesses by key, in recording order */
+    std::unordered_map<std::string, std::deque<Record>> replay;
+    /** @brief Number of recorded accesses not replayed yet */
+    size_t remaining = 0;
+    /** @brief Number of recorded accesses replayed */
+    size_t taken = 0;
+};
+
+} // namespace smbus
+} // namespace phosphor
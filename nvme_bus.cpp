@@ -0,0 +1,481 @@
+#include "nvme_bus.hpp"
+
+#include "nvme_log.hpp"
+#include "nvme_tracer.hpp"
+#include "smbus.hpp"
+
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace phosphor
+{
+namespace nvme
+{
+
+void NvmeBus::Transaction::setCommandCodes(
+    const std::vector<uint8_t>& codes, const std::vector<uint8_t>& minLengths)
+{
+    commandCodes = codes;
+    this->minLengths = minLengths;
+    this->minLengths.resize(codes.size());
+    responses.resize(codes.size());
+    results.resize(codes.size());
+}
+
+NvmeBus::NvmeBus(const sdeventplus::Event& event, uint8_t busID,
+                 const Settings& settings) :
+    busID(busID),
+    settings(settings), eventFd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+    kickEvent(event,
+              [this](sdeventplus::source::EventBase&) {
+                  wakeup.notify_one();
+              }),
+    deadlineTimer(event, [this](auto&) { checkDeadlines(); })
+{
+    kickEvent.set_enabled(sdeventplus::source::Enabled::Off);
+
+    if (eventFd < 0)
+    {
+        // Without a completion wakeup the bus refuses every transaction.
+        logError("i2c-bus-" + std::to_string(busID),
+                 "Can not create the I2C bus completion eventfd",
+                 {{"I2C_BUS", std::to_string(busID)},
+                  {"ERROR", strerror(errno)}});
+        return;
+    }
+
+    eventSource.emplace(event, eventFd, EPOLLIN,
+                        [this](sdeventplus::source::IO&, int, uint32_t) {
+                            complete();
+                        });
+    thread = std::thread(&NvmeBus::worker, this);
+}
+
+NvmeBus::~NvmeBus()
+{
+    if (thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wakeup.notify_one();
+        thread.join();
+    }
+
+    if (eventSource)
+    {
+        eventSource->set_enabled(sdeventplus::source::Enabled::Off);
+    }
+    if (eventFd >= 0)
+    {
+        close(eventFd);
+    }
+}
+
+void NvmeBus::detach()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wakeup.notify_one();
+    if (thread.joinable())
+    {
+        thread.detach();
+    }
+
+    if (eventSource)
+    {
+        eventSource->set_enabled(sdeventplus::source::Enabled::Off);
+    }
+    kickEvent.set_enabled(sdeventplus::source::Enabled::Off);
+    deadlineTimer.setEnabled(false);
+}
+
+bool NvmeBus::submit(Transaction& transaction)
+{
+    if (!eventSource || isHung || transaction.busy ||
+        held == maxTransactions)
+    {
+        return false;
+    }
+
+    ++held;
+    transaction.busy = true;
+    transaction.timedOut = false;
+    transaction.deadline = std::chrono::steady_clock::now() + settings.deadline;
+    transaction.next = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (queueTail)
+        {
+            queueTail->next = &transaction;
+        }
+        else
+        {
+            queueHead = &transaction;
+        }
+        queueTail = &transaction;
+    }
+
+    // Wake the worker once the event loop is done submitting, so that the
+    // transactions of a cycle share its transfers.
+    kickEvent.set_enabled(sdeventplus::source::Enabled::OneShot);
+
+    armDeadline();
+
+    return true;
+}
+
+void NvmeBus::worker()
+{
+    while (true)
+    {
+        Transaction* batch;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            wakeup.wait(lock, [this] { return stop || queueHead; });
+            if (stop)
+            {
+                return;
+            }
+
+            // Take every queued transaction.
+            batch = queueHead;
+            queueHead = nullptr;
+            queueTail = nullptr;
+            running = batch;
+        }
+
+        run(batch);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = nullptr;
+        }
+
+        // A transaction may be submitted again as soon as it is handed
+        // back, take its successor first.
+        while (batch)
+        {
+            auto transaction = batch;
+            batch = transaction->next;
+            completed.push(transaction);
+        }
+
+        uint64_t one = 1;
+        if (write(eventFd, &one, sizeof(one)) < 0)
+        {
+            logError("i2c-bus-" + std::to_string(busID),
+                     "Can not wake the event loop",
+                     {{"I2C_BUS", std::to_string(busID)},
+                      {"ERROR", strerror(errno)}});
+        }
+    }
+}
+
+void NvmeBus::run(Transaction* batch)
+{
+    phosphor::smbus::Smbus smbus;
+    auto lane = NvmeTracer::busLane(busID);
+
+    bool opened;
+    {
+        NvmeTracer::Span span("smbusInit", nullptr, lane);
+        opened = (smbus.smbusInit(busID) != -1);
+    }
+    for (auto transaction = batch; transaction;
+         transaction = transaction->next)
+    {
+        transaction->opened = opened;
+    }
+    if (!opened)
+    {
+        return;
+    }
+
+    int timeoutResult;
+    {
+        NvmeTracer::Span span("smbusSetTimeout", nullptr, lane);
+        timeoutResult = smbus.smbusSetTimeout(
+            busID, settings.timeout.count(), settings.retries);
+    }
+    if (timeoutResult < 0)
+    {
+        logError("i2c-bus-" + std::to_string(busID),
+                 "Can not set I2C timeout",
+                 {{"I2C_BUS", std::to_string(busID)},
+                  {"ERROR", strerror(errno)}});
+    }
+
+    // The block reads of every transaction, whichever device they address,
+    // run in as few I2C_RDWR transfers as the adapter takes.
+    using Smbus = phosphor::smbus::Smbus;
+    Smbus::BlockRead reads[Smbus::maxBatchReads];
+    std::pair<Transaction*, size_t> owners[Smbus::maxBatchReads];
+    size_t count = 0;
+
+    auto transfer = [&]() {
+        int result;
+        int err;
+        {
+            NvmeTracer::Span span("I2C_RDWR", nullptr, lane);
+            result = smbus.SendSmbusRWBlockCmdsRAW(busID, reads, count,
+                                                   settings.pec);
+            err = errno;
+        }
+
+        for (size_t k = 0; k < count; ++k)
+        {
+            auto& [transaction, i] = owners[k];
+
+            transaction->results[i] =
+                (reads[k].result < 0) ? failure(err) : reads[k].result;
+            if (transaction->results[i] >= 0 &&
+                !validResponse(*transaction, i))
+            {
+                transaction->results[i] = -EBADMSG;
+            }
+
+            // A failed transfer did not tell which read failed, each of them
+            // gets a read of its own on top of the retries.
+            readCommand(smbus, *transaction, i,
+                        settings.commandRetries + (result < 0));
+
+            // An endpoint that still fails would fail the combined
+            // transfer of every other endpoint in the next cycles too.
+            if (result < 0 && transaction->results[i] < 0)
+            {
+                unbatched[transaction->address & 0x7f] = true;
+            }
+        }
+
+        count = 0;
+    };
+
+    for (auto transaction = batch; transaction;
+         transaction = transaction->next)
+    {
+        auto& isolated = unbatched[transaction->address & 0x7f];
+        if (isolated)
+        {
+            // Read on its own, it rejoins the batch once it answers.
+            auto answered = false;
+            for (size_t i = 0; i < transaction->commandCodes.size(); ++i)
+            {
+                transaction->results[i] = -EIO;
+                readCommand(smbus, *transaction, i,
+                            settings.commandRetries + 1);
+                answered |= (transaction->results[i] >= 0);
+            }
+            isolated = !answered;
+            continue;
+        }
+
+        for (size_t i = 0; i < transaction->commandCodes.size(); ++i)
+        {
+            transaction->responses[i].fill(0);
+            reads[count] = {transaction->address,
+                            &transaction->commandCodes[i], 1,
+                            transaction->responses[i].data(), 0};
+            owners[count] = {transaction, i};
+
+            if (++count == Smbus::maxBatchReads)
+            {
+                transfer();
+            }
+        }
+    }
+    if (count)
+    {
+        transfer();
+    }
+
+    smbus.smbusClose(busID);
+}
+
+void NvmeBus::readCommand(phosphor::smbus::Smbus& smbus,
+                          Transaction& transaction, size_t i,
+                          uint32_t attempts)
+{
+    uint8_t txData = transaction.commandCodes[i];
+
+    // Only a failed command is read again, within the retry budget.
+    for (uint32_t attempt = 0;
+         attempt < attempts && transaction.results[i] < 0; ++attempt)
+    {
+        NvmeTracer::Span span("SendSmbusRWBlockCmdRAW", nullptr,
+                              NvmeTracer::busLane(busID));
+
+        transaction.responses[i].fill(0);
+        auto result = smbus.SendSmbusRWBlockCmdRAW(
+            busID, transaction.address, &txData, sizeof(txData),
+            transaction.responses[i].data(), settings.pec);
+        transaction.results[i] = (result < 0) ? failure(errno) : result;
+
+        if (transaction.results[i] >= 0 && !validResponse(transaction, i))
+        {
+            transaction.results[i] = -EBADMSG;
+        }
+    }
+}
+
+bool NvmeBus::validResponse(const Transaction& transaction, size_t i) const
+{
+    const auto& response = transaction.responses[i];
+    auto length = response[0];
+
+    if (length < transaction.minLengths[i] ||
+        length + 1 + settings.pec > I2C_DATA_MAX ||
+        (settings.pec &&
+         !phosphor::smbus::Smbus::checkBlockReadPec(
+             transaction.address, &transaction.commandCodes[i], 1,
+             response.data())))
+    {
+        logError("i2c-response-" + std::to_string(busID),
+                 "Invalid SMBus block read response",
+                 {{"I2C_BUS", std::to_string(busID)},
+                  {"I2C_ADDRESS", std::to_string(transaction.address)},
+                  {"COMMAND_CODE", std::to_string(transaction.commandCodes[i])},
+                  {"LENGTH", std::to_string(length)}});
+        return false;
+    }
+
+    return true;
+}
+
+void NvmeBus::complete()
+{
+    uint64_t count;
+    if (read(eventFd, &count, sizeof(count)) < 0)
+    {
+        return;
+    }
+
+    Transaction* transaction;
+    while (completed.pop(transaction))
+    {
+        --held;
+        transaction->busy = false;
+
+        if (transaction->abandoned)
+        {
+            // Its owner was failed at the deadline already.
+            transaction->abandoned = false;
+            if (isHung)
+            {
+                isHung = false;
+                logInfo("i2c-bus-" + std::to_string(busID),
+                        "I2C bus recovered",
+                        {{"I2C_BUS", std::to_string(busID)}});
+            }
+            continue;
+        }
+
+        transaction->done(*transaction);
+    }
+
+    armDeadline();
+}
+
+void NvmeBus::checkDeadlines()
+{
+    auto now = std::chrono::steady_clock::now();
+    Transaction* failed = nullptr;
+    Transaction* stuck = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (running && !running->abandoned && running->deadline <= now)
+        {
+            // Nothing queued behind a hung batch makes its deadline.
+            for (auto transaction = running; transaction;
+                 transaction = transaction->next)
+            {
+                transaction->abandoned = true;
+            }
+            stuck = running;
+            failed = queueHead;
+            queueHead = nullptr;
+            queueTail = nullptr;
+        }
+        else
+        {
+            Transaction** tail = &failed;
+            while (queueHead && queueHead->deadline <= now)
+            {
+                *tail = queueHead;
+                tail = &queueHead->next;
+                queueHead = queueHead->next;
+            }
+            *tail = nullptr;
+            if (!queueHead)
+            {
+                queueTail = nullptr;
+            }
+        }
+    }
+
+    if (stuck)
+    {
+        // The worker still owns the batch, only answer the owners.
+        isHung = true;
+
+        logError("i2c-bus-" + std::to_string(busID),
+                 "I2C transaction missed its deadline, isolating the bus",
+                 {{"I2C_BUS", std::to_string(busID)},
+                  {"I2C_ADDRESS", std::to_string(stuck->address)}});
+
+        for (; stuck; stuck = stuck->next)
+        {
+            stuck->timedOut = true;
+            stuck->done(*stuck);
+        }
+    }
+
+    while (failed)
+    {
+        auto& transaction = *failed;
+        failed = transaction.next;
+
+        --held;
+        transaction.busy = false;
+        transaction.timedOut = true;
+        transaction.done(transaction);
+    }
+
+    armDeadline();
+}
+
+void NvmeBus::armDeadline()
+{
+    Transaction* first;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        first = (running && !running->abandoned) ? running : queueHead;
+    }
+
+    if (!first)
+    {
+        deadlineTimer.setEnabled(false);
+        return;
+    }
+
+    auto remaining = first->deadline - std::chrono::steady_clock::now();
+    deadlineTimer.restartOnce(std::max(
+        std::chrono::duration_cast<std::chrono::microseconds>(remaining),
+        std::chrono::microseconds(1)));
+}
+
+} // namespace nvme
+} // namespace phosphor
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <sdeventplus/clock.hpp>
+#include <sdeventplus/event.hpp>
+#include <sdeventplus/source/event.hpp>
+#include <sdeventplus/source/io.hpp>
+#include <sdeventplus/utility/timer.hpp>
+#include <thread>
+#include <vector>
+
+#include "i2c.h"
+#include "smbus.hpp"
+#include "nvme_ring.hpp"
+
+namespace phosphor
+{
+namespace nvme
+{
+
+/** @class NvmeBus
+ *  @brief Worker thread running the SMBus transactions of one I2C bus.
+ *
+ *  Transactions are queued from the event loop and run by the worker,
+ *  which takes every queued transaction at once and batches their block
+ *  reads, whichever device they address, into shared I2C_RDWR transfers.
+ *  It hands them back through a lock-free ring and wakes the event loop
+ *  through an eventfd, so that it never waits on the worker. A
+ *  transaction that misses its deadline is failed right away and the bus
+ *  is isolated until the worker returns from it, so that a hung bus holds
+ *  up neither the event loop nor the drives on other buses.
+ */
+class NvmeBus
+{
+  public:
+    NvmeBus() = delete;
+    NvmeBus(const NvmeBus&) = delete;
+    NvmeBus& operator=(const NvmeBus&) = delete;
+    NvmeBus(NvmeBus&&) = delete;
+    NvmeBus& operator=(NvmeBus&&) = delete;
+    ~NvmeBus();
+
+    /**
+     * Structure for keeping the settings of a bus
+     */
+    struct Settings
+    {
+        std::chrono::milliseconds timeout;  /* Adapter timeout  */
+        uint32_t retries;                   /* Adapter retries  */
+        std::chrono::milliseconds deadline; /* Deadline of a transaction  */
+        bool pec;                /* Read and check the PEC byte  */
+        uint32_t commandRetries; /* Retries of a failed command  */
+    };
+
+    /**
+     * Structure for keeping a batch of block reads from one device. It is
+     * owned by the submitter and reused for every submission.
+     */
+    struct Transaction
+    {
+        uint8_t address;                   /* I2C slave address  */
+        std::vector<uint8_t> commandCodes; /* Command codes to read  */
+        /* Minimum block lengths by position in commandCodes */
+        std::vector<uint8_t> minLengths;
+        /* Block read responses by position in commandCodes, the first
+         * byte is the block length */
+        std::vector<std::array<uint8_t, I2C_DATA_MAX>> responses;
+        /* Results by position in commandCodes, the negative errno of a
+         * failed read */
+        std::vector<int> results;
+        bool opened;   /* Whether the bus could be opened  */
+        bool timedOut; /* Whether the deadline passed, results are unset */
+        /* Called on the event loop once the transaction is done */
+        std::function<void(Transaction&)> done;
+
+        /** @brief Set the command codes and size the result buffers
+         *
+         * @param[in] codes      - Command codes to read
+         * @param[in] minLengths - Minimum block lengths by position in
+         *                         codes, a shorter block is a failure
+         */
+        void setCommandCodes(const std::vector<uint8_t>& codes,
+                             const std::vector<uint8_t>& minLengths = {});
+
+        /* Owned by NvmeBus while the transaction is queued or running */
+        bool busy = false;
+        bool abandoned = false;
+        std::chrono::steady_clock::time_point deadline;
+        Transaction* next = nullptr;
+    };
+
+    /** @brief Transactions a bus holds at once, queued, running or done
+     *         and not yet handed back
+     */
+    static constexpr size_t maxTransactions = 64;
+
+    /** @brief Constructs NvmeBus
+     *
+     * @param[in] event    - Event loop the transactions complete in
+     * @param[in] busID    - I2C bus number
+     * @param[in] settings - Bus settings
+     */
+    NvmeBus(const sdeventplus::Event& event, uint8_t busID,
+            const Settings& settings);
+
+    /** @brief Queue a transaction
+     *
+     * @param[in] transaction - Transaction to run
+     *
+     * @return Whether it was queued; false if the bus is isolated, has no
+     *         worker, holds maxTransactions already or the transaction has
+     *         not returned yet, done is then not called
+     */
+    bool submit(Transaction& transaction);
+
+    /** @brief Whether the bus is isolated after a missed deadline */
+    bool hung() const
+    {
+        return isHung;
+    }
+
+    /** @brief Stop handling the bus without joining its worker
+     *
+     * The worker of an isolated bus is stuck in a transfer that may never
+     * return; it is detached and keeps writing to the bus and to the
+     * transactions it runs, so both must then be leaked, not destroyed.
+     */
+    void detach();
+
+  private:
+    /** @brief Run the queued transactions */
+    void worker();
+
+    /** @brief Run the block reads of a batch of transactions
+     *
+     * @param[in] batch - Transactions linked by next
+     */
+    void run(Transaction* batch);
+
+    /** @brief Read a failed command of a transaction on its own
+     *
+     * @param[in] smbus       - Opened bus
+     * @param[in] transaction - Transaction of the command
+     * @param[in] i           - Position of the command in commandCodes
+     * @param[in] attempts    - Most reads of the command
+     */
+    void readCommand(phosphor::smbus::Smbus& smbus, Transaction& transaction,
+                     size_t i, uint32_t attempts);
+
+    /** @brief Result of a failed read from the errno it left, a read
+     *         that failed without setting errno counts as EIO
+     */
+    static int failure(int err)
+    {
+        return -(err ? err : EIO);
+    }
+
+    /** @brief Check the length and the PEC of a block read response
+     *
+     * @param[in] transaction - Transaction of the response
+     * @param[in] i           - Position of the response in commandCodes
+     */
+    bool validResponse(const Transaction& transaction, size_t i) const;
+
+    /** @brief Hand the completed transactions back to their owners */
+    void complete();
+
+    /** @brief Fail the transactions whose deadline passed */
+    void checkDeadlines();
+
+    /** @brief Arm the deadline timer for the oldest pending transaction */
+    void armDeadline();
+
+    uint8_t busID;
+    Settings settings;
+
+    /** @brief Wakes the event loop when transactions complete, no worker
+     *         is started if it can not be created
+     */
+    int eventFd;
+    std::optional<sdeventplus::source::IO> eventSource;
+    /** @brief Wakes the worker once the event loop is done submitting */
+    sdeventplus::source::Defer kickEvent;
+    sdeventplus::utility::Timer<sdeventplus::ClockId::Monotonic> deadlineTimer;
+
+    /** @brief Protects the queue, running and stop */
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    /** @brief Queued transactions, in submission order */
+    Transaction* queueHead = nullptr;
+    Transaction* queueTail = nullptr;
+    /** @brief Transactions the worker is running, linked by next */
+    Transaction* running = nullptr;
+    bool stop = false;
+
+    /** @brief Transactions done by the worker, in completion order. It can
+     *         not overflow as submit() bounds the transactions held.
+     */
+    NvmeRing<Transaction*, maxTransactions> completed;
+    /** @brief Number of transactions held, only used by the event loop */
+    size_t held = 0;
+    /** @brief Endpoints by 7-bit address that failed a combined transfer
+     *         and are read on their own until they answer again, only used
+     *         by the worker
+     */
+    std::array<bool, 128> unbatched{};
+
+    /** @brief Whether the bus is isolated, only used by the event loop */
+    bool isHung = false;
+
+    std::thread thread;
+};
+
+} // namespace nvme
+} // namespace phosphor
@@ -0,0 +1,194 @@
+#include "nvme_health.hpp"
+
+#include "nvme_log.hpp"
+
+#include <sdbusplus/vtable.hpp>
+
+#include "i2c.h"
+
+namespace phosphor
+{
+namespace nvme
+{
+
+static constexpr const uint8_t COMMAND_CODE_0 = 0;
+static constexpr const uint8_t COMMAND_CODE_8 = 8;
+
+/* Minimum block lengths of the data structures decoded by the poll loop */
+static constexpr const uint8_t COMMAND_CODE_0_MIN_LEN = 6;
+static constexpr const uint8_t COMMAND_CODE_8_MIN_LEN = 22;
+
+static constexpr auto unavailableError =
+    "xyz.openbmc_project.Common.Error.Unavailable";
+
+static const sdbusplus::vtable::vtable_t healthVtable[] = {
+    sdbusplus::vtable::start(),
+    sdbusplus::vtable::method("GetExtendedHealth", "", "ta{yay}",
+                              NvmeHealth::getExtendedHealth),
+    sdbusplus::vtable::end()};
+
+NvmeHealth::NvmeHealth(sdbusplus::bus::bus& bus,
+                       const sdeventplus::Event& event, NvmeBus& i2cBus,
+                       const std::string& objPath, uint8_t busID,
+                       uint8_t address,
+                       const std::vector<uint8_t>& commandCodes,
+                       std::chrono::seconds ttl) :
+    healthIface(bus, objPath.c_str(), NVME_HEALTH_IFACE, healthVtable, this),
+    updateEvent(event, [this](sdeventplus::source::EventBase&) { update(); }),
+    i2cBus(i2cBus), busID(busID), ttl(ttl)
+{
+    transaction.address = address;
+    transaction.setCommandCodes(commandCodes);
+    transaction.done = [this](NvmeBus::Transaction&) { completed(); };
+
+    // Let pending method calls be dispatched before the bus transaction
+    // runs, so that they are coalesced into it.
+    updateEvent.set_priority(SD_EVENT_PRIORITY_IDLE);
+    updateEvent.set_enabled(sdeventplus::source::Enabled::Off);
+}
+
+NvmeHealth::~NvmeHealth()
+{
+    for (auto& call : waiters)
+    {
+        sd_bus_reply_method_errorf(call.get(), unavailableError,
+                                   "NVMe drive removed");
+    }
+}
+
+int NvmeHealth::getExtendedHealth(sd_bus_message* msg, void* context,
+                                  sd_bus_error* error)
+{
+    auto health = static_cast<NvmeHealth*>(context);
+    sdbusplus::message::message call(msg);
+
+    if (health->cached &&
+        std::chrono::steady_clock::now() - health->sampleTime < health->ttl)
+    {
+        health->reply(call);
+        return 1;
+    }
+
+    if (health->waiters.empty())
+    {
+        health->updateEvent.set_enabled(
+            sdeventplus::source::Enabled::OneShot);
+    }
+    health->waiters.push_back(std::move(call));
+
+    return 1;
+}
+
+void NvmeHealth::update()
+{
+    // Callers arriving while the read is queued or running are answered
+    // by it.
+    if (!i2cBus.submit(transaction))
+    {
+        fail();
+    }
+}
+
+void NvmeHealth::completed()
+{
+    Blocks result;
+
+    if (fetch(result))
+    {
+        blocks = std::move(result);
+        sampleTime = std::chrono::steady_clock::now();
+        sampleTimestamp =
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch())
+                .count();
+        cached = true;
+
+        for (auto& call : waiters)
+        {
+            reply(call);
+        }
+    }
+    else
+    {
+        fail();
+    }
+
+    waiters.clear();
+}
+
+void NvmeHealth::fail()
+{
+    for (auto& call : waiters)
+    {
+        sd_bus_reply_method_errorf(call.get(), unavailableError,
+                                   "Can not read NVMe drive health data");
+    }
+
+    waiters.clear();
+}
+
+/** @brief Check that a data block is complete */
+static bool validBlock(uint8_t commandCode, const uint8_t* rsp)
+{
+    auto len = rsp[0];
+
+    if (len == 0 || len > I2C_SMBUS_BLOCK_MAX)
+    {
+        return false;
+    }
+
+    switch (commandCode)
+    {
+        case COMMAND_CODE_0:
+            return len >= COMMAND_CODE_0_MIN_LEN;
+        case COMMAND_CODE_8:
+            return len >= COMMAND_CODE_8_MIN_LEN;
+        default:
+            return true;
+    }
+}
+
+bool NvmeHealth::fetch(Blocks& result)
+{
+    if (transaction.timedOut || !transaction.opened)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < transaction.commandCodes.size(); ++i)
+    {
+        auto commandCode = transaction.commandCodes[i];
+        const auto& rsp = transaction.responses[i];
+
+        if (transaction.results[i] < 0)
+        {
+            continue;
+        }
+
+        if (!validBlock(commandCode, rsp.data()))
+        {
+            logError("health-" + std::to_string(busID),
+                     "Invalid NVMe-MI data block",
+                     {{"I2C_BUS", std::to_string(busID)},
+                      {"COMMAND_CODE", std::to_string(commandCode)},
+                      {"LENGTH", std::to_string(rsp[0])}});
+            continue;
+        }
+
+        result.emplace(commandCode, std::vector<uint8_t>(
+                                        rsp.begin() + 1,
+                                        rsp.begin() + 1 + rsp[0]));
+    }
+
+    return !result.empty();
+}
+
+void NvmeHealth::reply(sdbusplus::message::message& call)
+{
+    auto response = call.new_method_return();
+    response.append(sampleTimestamp, blocks);
+    response.method_return();
+}
+
+} // namespace nvme
+} // namespace phosphor
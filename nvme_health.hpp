@@ -0,0 +1,113 @@
+#pragma once
+
+#include "config.h"
+
+#include "nvme_bus.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <sdbusplus/bus.hpp>
+#include <sdbusplus/message.hpp>
+#include <sdbusplus/server.hpp>
+#include <sdbusplus/server/interface.hpp>
+#include <sdeventplus/event.hpp>
+#include <sdeventplus/source/event.hpp>
+#include <string>
+#include <vector>
+
+namespace phosphor
+{
+namespace nvme
+{
+
+/** @class NvmeHealth
+ *  @brief On-demand extended NVMe-MI health data of one drive.
+ *
+ *  Implements the GetExtendedHealth method on the drive object. The basic
+ *  management data blocks are read over SMBus, by the worker of the I2C
+ *  bus, only when requested, cached
+ *  for a configurable time, and all callers waiting for the same drive are
+ *  answered from a single bus transaction.
+ */
+class NvmeHealth
+{
+  public:
+    NvmeHealth() = delete;
+    NvmeHealth(const NvmeHealth&) = delete;
+    NvmeHealth& operator=(const NvmeHealth&) = delete;
+    NvmeHealth(NvmeHealth&&) = delete;
+    NvmeHealth& operator=(NvmeHealth&&) = delete;
+    ~NvmeHealth();
+
+    /** @brief Data blocks by NVMe-MI command code */
+    using Blocks = std::map<uint8_t, std::vector<uint8_t>>;
+
+    /** @brief Constructs NvmeHealth
+     *
+     * @param[in] bus          - Handle to system dbus
+     * @param[in] event        - Event loop the bus transaction runs in
+     * @param[in] i2cBus       - Worker of the I2C bus of the drive
+     * @param[in] objPath      - The dbus path of nvme
+     * @param[in] busID        - I2C bus of the drive
+     * @param[in] address      - I2C address of the drive
+     * @param[in] commandCodes - Command codes of the data blocks to read
+     * @param[in] ttl          - Time a result is served from the cache
+     */
+    NvmeHealth(sdbusplus::bus::bus& bus, const sdeventplus::Event& event,
+               NvmeBus& i2cBus, const std::string& objPath, uint8_t busID,
+               uint8_t address, const std::vector<uint8_t>& commandCodes,
+               std::chrono::seconds ttl);
+
+    /** @brief D-Bus handler of GetExtendedHealth */
+    static int getExtendedHealth(sd_bus_message* msg, void* context,
+                                 sd_bus_error* error);
+
+  private:
+    /** @brief Queue the read of the data blocks */
+    void update();
+
+    /** @brief Answer the waiting callers with the data blocks read */
+    void completed();
+
+    /** @brief Collect the data blocks of the completed read
+     *
+     * @param[out] blocks - Validated data blocks
+     *
+     * @return Whether any data block was read
+     */
+    bool fetch(Blocks& blocks);
+
+    /** @brief Answer the waiting callers with an error */
+    void fail();
+
+    /** @brief Send the cached result to a caller */
+    void reply(sdbusplus::message::message& call);
+
+    /** @brief Handle of the D-Bus interface */
+    sdbusplus::server::interface::interface healthIface;
+    /** @brief Deferred event running the bus transaction */
+    sdeventplus::source::Defer updateEvent;
+
+    /** @brief Worker of the I2C bus of the drive */
+    NvmeBus& i2cBus;
+    /** @brief Block reads of the data blocks */
+    NvmeBus::Transaction transaction;
+
+    uint8_t busID;
+    std::chrono::seconds ttl;
+
+    /** @brief Cached data blocks */
+    Blocks blocks;
+    /** @brief When the cached blocks were read */
+    std::chrono::steady_clock::time_point sampleTime;
+    /** @brief Wall clock time of the cached blocks in microseconds */
+    uint64_t sampleTimestamp = 0;
+    /** @brief Whether the cache holds a result */
+    bool cached = false;
+    /** @brief Callers waiting for the next bus transaction */
+    std::vector<sdbusplus::message::message> waiters;
+};
+
+} // namespace nvme
+} // namespace phosphor
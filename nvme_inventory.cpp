@@ -0,0 +1,24 @@
+#include "nvme_inventory.hpp"
+
+#include <tuple>
+#include <vector>
+
+namespace phosphor
+{
+namespace nvme
+{
+
+NvmeInventory::NvmeInventory(sdbusplus::bus::bus& bus,
+                             const std::string& objPath,
+                             const std::string& inventoryPath) :
+    InventoryIfaces(bus, objPath.c_str(), true)
+{
+    std::vector<std::tuple<std::string, std::string, std::string>>
+        associations = {{"inventory", "status", inventoryPath}};
+    AssociationInterface::associations(associations, true);
+
+    emit_object_added();
+}
+
+} // namespace nvme
+} // namespace phosphor
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "config.h"
+
+#include <sdbusplus/bus.hpp>
+#include <sdbusplus/server.hpp>
+#include <string>
+#include <xyz/openbmc_project/Association/Definitions/server.hpp>
+#include <xyz/openbmc_project/Inventory/Decorator/Asset/server.hpp>
+#include <xyz/openbmc_project/Inventory/Item/server.hpp>
+#include <xyz/openbmc_project/Nvme/Status/server.hpp>
+
+namespace phosphor
+{
+namespace nvme
+{
+
+using ItemInterface = sdbusplus::xyz::openbmc_project::Inventory::server::Item;
+
+using AssetInterface =
+    sdbusplus::xyz::openbmc_project::Inventory::Decorator::server::Asset;
+
+using StatusInterface = sdbusplus::xyz::openbmc_project::Nvme::server::Status;
+
+using AssociationInterface =
+    sdbusplus::xyz::openbmc_project::Association::server::Definitions;
+
+using InventoryIfaces =
+    sdbusplus::server::object::object<ItemInterface, AssetInterface,
+                                      StatusInterface, AssociationInterface>;
+
+/** @class NvmeInventory
+ *  @brief Inventory interfaces of one drive bay hosted by this service.
+ *
+ *  Used instead of setting the properties on the Inventory Manager, so
+ *  that an update is a write to a local object rather than a D-Bus call.
+ *  The object is associated with the inventory item of the bay.
+ */
+class NvmeInventory : public InventoryIfaces
+{
+  public:
+    NvmeInventory() = delete;
+    NvmeInventory(const NvmeInventory&) = delete;
+    NvmeInventory& operator=(const NvmeInventory&) = delete;
+    NvmeInventory(NvmeInventory&&) = delete;
+    NvmeInventory& operator=(NvmeInventory&&) = delete;
+    virtual ~NvmeInventory() = default;
+
+    /** @brief Constructs NvmeInventory and announces it on D-Bus
+     *
+     * @param[in] bus           - Handle to system dbus
+     * @param[in] objPath       - The dbus path of the object
+     * @param[in] inventoryPath - Inventory item of the drive bay
+     */
+    NvmeInventory(sdbusplus::bus::bus& bus, const std::string& objPath,
+                  const std::string& inventoryPath);
+};
+
+} // namespace nvme
+} // namespace phosphor
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace phosphor
+{
+namespace nvme
+{
+
+/**
+ * Structure for keeping the position of a field in the block read
+ * responses of a poll
+ */
+struct Field
+{
+    uint8_t block;  /* Position of the command in the layout commandCodes  */
+    uint8_t offset; /* Offset in the response, byte 0 is the block length  */
+    uint8_t length; /* Number of bytes, 0 if the layout does not read it  */
+};
+
+/**
+ * Structure for keeping the SMART warning bits of the drive faults, a
+ * clear bit means the fault is present
+ */
+struct FaultMasks
+{
+    int capacity;
+    int temperature;
+    int degrades;
+    int media;
+    int backupDevice;
+};
+
+/** @brief NVMe-MI basic management command layout
+ *
+ *  A layout is a type holding the command codes read in a poll, the
+ *  NVMe-MI block length of each, the position of every decoded field and
+ *  the fault masks, all as constant expressions, so that the decoder
+ *  specialised for it reads the fields with direct loads. A new layout
+ *  only needs such a type and an entry in the layout table.
+ */
+struct BasicLayout
+{
+    static constexpr const char* name = "basic";
+
+    static constexpr std::array<uint8_t, 2> commandCodes = {0, 8};
+    static constexpr std::array<uint8_t, 2> blockLengths = {6, 22};
+
+    static constexpr Field statusFlags = {0, 1, 1};
+    static constexpr Field smartWarnings = {0, 2, 1};
+    static constexpr Field temperature = {0, 3, 1};
+    static constexpr Field driveLifeUsed = {0, 4, 1};
+    static constexpr Field vendor = {1, 1, 2};
+    static constexpr Field serialNumber = {1, 3, 20};
+
+    static constexpr FaultMasks faults = {1, 1 << 1, 1 << 2, 1 << 3, 1 << 4};
+};
+
+/** @brief Status block only layout
+ *
+ *  Reads command code 0 alone, for drives whose vendor ID and serial number
+ *  block is not readable. It halves the block reads of a poll; vendor and
+ *  serial number are published empty.
+ */
+struct StatusLayout
+{
+    static constexpr const char* name = "status";
+
+    static constexpr std::array<uint8_t, 1> commandCodes = {0};
+    static constexpr std::array<uint8_t, 1> blockLengths = {6};
+
+    static constexpr Field statusFlags = BasicLayout::statusFlags;
+    static constexpr Field smartWarnings = BasicLayout::smartWarnings;
+    static constexpr Field temperature = BasicLayout::temperature;
+    static constexpr Field driveLifeUsed = BasicLayout::driveLifeUsed;
+    static constexpr Field vendor = {};
+    static constexpr Field serialNumber = {};
+
+    static constexpr FaultMasks faults = BasicLayout::faults;
+};
+
+/** @brief Whether a field lies within the block length of its command,
+ *         and is read without a bounds check; a field the layout does not
+ *         read always fits
+ */
+template <typename Layout>
+constexpr bool fieldFits(const Field& field)
+{
+    if (field.length == 0)
+    {
+        return true;
+    }
+    return field.block < Layout::commandCodes.size() &&
+           field.offset > 0 &&
+           field.offset + field.length <= Layout::blockLengths[field.block] + 1;
+}
+
+} // namespace nvme
+} // namespace phosphor
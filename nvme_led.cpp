@@ -0,0 +1,141 @@
+#include "nvme_led.hpp"
+
+#include <map>
+#include <xyz/openbmc_project/Led/Physical/server.hpp>
+
+namespace phosphor
+{
+namespace nvme
+{
+
+NvmeLed::NvmeLed(sdbusplus::bus::bus& bus,
+                 const std::string& faultLedGroupPath,
+                 const std::string& locateLedGroupPath,
+                 const std::string& locateLedBusName,
+                 const std::string& locateLedPath) :
+    bus(bus),
+    faultLedGroupPath(faultLedGroupPath),
+    locateLedGroupPath(locateLedGroupPath),
+    locateLedBusName(locateLedBusName), locateLedPath(locateLedPath),
+    faultLedGroup(util::SDBusPlus::target(LED_GROUP_BUSNAME, faultLedGroupPath,
+                                          LED_GROUP_IFACE)),
+    locateLedController(util::SDBusPlus::target(
+        locateLedBusName, locateLedPath, LED_CONTROLLER_IFACE))
+{
+    faultCalls.onDone([this](bool failed) {
+        if (failed)
+        {
+            commandedFault.reset();
+        }
+    });
+    locateCalls.onDone([this](bool failed) {
+        if (failed)
+        {
+            commandedLocate.reset();
+        }
+    });
+
+    if (locateLedGroupPath.empty())
+    {
+        return;
+    }
+
+    // Follow the Identify state instead of reading it before every Set.
+    identifyMatch.emplace(
+        bus,
+        sdbusplus::bus::match::rules::propertiesChanged(locateLedGroupPath,
+                                                        LED_GROUP_IFACE),
+        [this](sdbusplus::message::message& msg) { identifyChanged(msg); });
+
+    util::SDBusPlus::getProperty(
+        bus,
+        util::SDBusPlus::target(LED_GROUP_BUSNAME, locateLedGroupPath,
+                                LED_GROUP_IFACE),
+        "Asserted", identify);
+}
+
+void NvmeLed::request(bool fault, bool locate)
+{
+    requestedFault = fault;
+    requestedLocate = locate;
+
+    apply();
+}
+
+void NvmeLed::restore(bool fault, bool locate)
+{
+    requestedFault = fault;
+    requestedLocate = locate;
+    commandedFault = fault;
+    commandedLocate = locate;
+}
+
+void NvmeLed::invalidate()
+{
+    commandedFault.reset();
+    commandedLocate.reset();
+
+    apply();
+}
+
+void NvmeLed::apply()
+{
+    if (identify)
+    {
+        return;
+    }
+
+    if (!locateLedGroupPath.empty() && !faultLedGroupPath.empty() &&
+        commandedFault != requestedFault)
+    {
+        // A Set that can not be sent or whose reply fails is tried again
+        // with the next request.
+        faultCalls.begin();
+        if (faultCalls.setProperty(bus, faultLedGroup, "Asserted",
+                                   requestedFault) == 0)
+        {
+            commandedFault = requestedFault;
+        }
+    }
+
+    if (!locateLedGroupPath.empty() && !locateLedBusName.empty() &&
+        !locateLedPath.empty() && commandedLocate != requestedLocate)
+    {
+        namespace server = sdbusplus::xyz::openbmc_project::Led::server;
+
+        locateCalls.begin();
+        if (locateCalls.setProperty(
+                bus, locateLedController, "State",
+                server::convertForMessage(
+                    requestedLocate ? server::Physical::Action::On
+                                    : server::Physical::Action::Off)) == 0)
+        {
+            commandedLocate = requestedLocate;
+        }
+    }
+}
+
+void NvmeLed::identifyChanged(sdbusplus::message::message& msg)
+{
+    std::string interface;
+    std::map<std::string, sdbusplus::message::variant<bool>> properties;
+
+    msg.read(interface, properties);
+
+    auto asserted = properties.find("Asserted");
+    if (asserted == properties.end())
+    {
+        return;
+    }
+
+    identify = sdbusplus::message::variant_ns::get<bool>(asserted->second);
+    if (!identify)
+    {
+        // The Identify group drove the LEDs while it was asserted, command
+        // the requested states again.
+        invalidate();
+    }
+}
+
+} // namespace nvme
+} // namespace phosphor
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "config.h"
+
+#include "sdbusplus.hpp"
+
+#include <optional>
+#include <sdbusplus/bus.hpp>
+#include <sdbusplus/bus/match.hpp>
+#include <string>
+
+namespace phosphor
+{
+namespace nvme
+{
+
+/** @class NvmeLed
+ *  @brief Fault and locate LED state machine of one drive bay.
+ *
+ *  Remembers the LED states last commanded on D-Bus and only issues a Set
+ *  when the requested state differs from it. While the Identify (locate
+ *  group) LED is asserted the LEDs are left alone, and the requested state
+ *  is commanded again once it is released.
+ */
+class NvmeLed
+{
+  public:
+    NvmeLed() = delete;
+    NvmeLed(const NvmeLed&) = delete;
+    NvmeLed& operator=(const NvmeLed&) = delete;
+    NvmeLed(NvmeLed&&) = delete;
+    NvmeLed& operator=(NvmeLed&&) = delete;
+
+    /** @brief Constructs NvmeLed
+     *
+     * @param[in] bus                - Handle to system dbus
+     * @param[in] faultLedGroupPath  - Fault LED group object path
+     * @param[in] locateLedGroupPath - Locate LED group object path
+     * @param[in] locateLedBusName   - Locate LED controller bus name
+     * @param[in] locateLedPath      - Locate LED controller object path
+     */
+    NvmeLed(sdbusplus::bus::bus& bus, const std::string& faultLedGroupPath,
+            const std::string& locateLedGroupPath,
+            const std::string& locateLedBusName,
+            const std::string& locateLedPath);
+
+    /** @brief Request the LED states of the bay
+     *
+     * @param[in] fault  - Whether the fault LED is asserted
+     * @param[in] locate - Whether the locate LED is on
+     */
+    void request(bool fault, bool locate);
+
+    /** @brief Seed the commanded states, e.g. from a previous instance */
+    void restore(bool fault, bool locate);
+
+    /** @brief Forget the commanded states, so that the requested states
+     *         are commanded again, e.g. after the LED manager restarted
+     */
+    void invalidate();
+
+    /** @brief Last commanded fault LED state */
+    bool fault() const
+    {
+        return commandedFault.value_or(false);
+    }
+
+    /** @brief Last commanded locate LED state */
+    bool locate() const
+    {
+        return commandedLocate.value_or(false);
+    }
+
+  private:
+    /** @brief Command the requested states that differ from the
+     *         commanded ones
+     */
+    void apply();
+
+    /** @brief Handle PropertiesChanged of the locate LED group */
+    void identifyChanged(sdbusplus::message::message& msg);
+
+    sdbusplus::bus::bus& bus;
+    std::string faultLedGroupPath;
+    std::string locateLedGroupPath;
+    std::string locateLedBusName;
+    std::string locateLedPath;
+    /** @brief Interfaces the LED states are set on */
+    util::SDBusPlus::Target faultLedGroup;
+    util::SDBusPlus::Target locateLedController;
+
+    /** @brief Requested LED states */
+    bool requestedFault = false;
+    bool requestedLocate = false;
+    /** @brief LED states last commanded on D-Bus */
+    std::optional<bool> commandedFault;
+    std::optional<bool> commandedLocate;
+    /** @brief Pending Sets, a failed reply forgets the commanded state */
+    util::AsyncCalls faultCalls;
+    util::AsyncCalls locateCalls;
+    /** @brief Whether the Identify LED group is asserted */
+    bool identify = false;
+
+    /** @brief Match of the locate LED group Asserted changes */
+    std::optional<sdbusplus::bus::match::match> identifyMatch;
+};
+
+} // namespace nvme
+} // namespace phosphor
@@ -0,0 +1,183 @@
+#include "nvme_log.hpp"
+
+namespace phosphor
+{
+namespace nvme
+{
+
+using namespace phosphor::logging;
+
+Logger& Logger::get()
+{
+    static Logger logger;
+    return logger;
+}
+
+Logger::Logger() : thread(&Logger::worker, this)
+{
+}
+
+Logger::~Logger()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    cv.notify_one();
+    thread.join();
+}
+
+void Logger::report(level priority, const std::string& key,
+                    const char* message, std::initializer_list<LogField> fields)
+{
+    auto now = std::chrono::steady_clock::now();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto& state = keys[key];
+        if (state.count == 0 || now - state.windowStart >= interval)
+        {
+            state.windowStart = now;
+            state.count = 0;
+        }
+
+        if (state.count >= burst)
+        {
+            ++state.suppressed;
+            return;
+        }
+        ++state.count;
+
+        if (queue.size() >= maxQueued)
+        {
+            ++dropped;
+            return;
+        }
+
+        Entry entry;
+        entry.level = priority;
+        entry.message = message;
+        entry.key = key;
+        entry.numFields = 0;
+        entry.suppressed = state.suppressed;
+        state.suppressed = 0;
+
+        for (const auto& field : fields)
+        {
+            if (entry.numFields == maxFields)
+            {
+                break;
+            }
+            entry.fields[entry.numFields++] =
+                std::string(field.name) + "=" + field.value;
+        }
+
+        queue.push_back(std::move(entry));
+    }
+
+    cv.notify_one();
+}
+
+/** @brief Send an entry with its structured fields to the journal */
+template <level L, typename... Args>
+static void send(const char* message, const char* key, unsigned suppressed,
+                 Args&&... fields)
+{
+    log<L>(message, entry("NVME_LOG_KEY=%s", key),
+           entry("NVME_LOG_SUPPRESSED=%u", suppressed),
+           entry("%s", fields)...);
+}
+
+template <level L>
+static void sendFields(const char* message, const char* key,
+                       unsigned suppressed,
+                       const std::array<std::string, Logger::maxFields>& fields,
+                       size_t numFields)
+{
+    switch (numFields)
+    {
+        case 0:
+            send<L>(message, key, suppressed);
+            break;
+        case 1:
+            send<L>(message, key, suppressed, fields[0].c_str());
+            break;
+        case 2:
+            send<L>(message, key, suppressed, fields[0].c_str(),
+                    fields[1].c_str());
+            break;
+        case 3:
+            send<L>(message, key, suppressed, fields[0].c_str(),
+                    fields[1].c_str(), fields[2].c_str());
+            break;
+        default:
+            send<L>(message, key, suppressed, fields[0].c_str(),
+                    fields[1].c_str(), fields[2].c_str(), fields[3].c_str());
+            break;
+    }
+}
+
+void Logger::worker()
+{
+    std::deque<Entry> pending;
+
+    while (true)
+    {
+        unsigned droppedEntries = 0;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] { return stop || !queue.empty(); });
+
+            if (queue.empty())
+            {
+                return;
+            }
+
+            pending.swap(queue);
+            droppedEntries = dropped;
+            dropped = 0;
+        }
+
+        if (droppedEntries != 0)
+        {
+            log<level::WARNING>("NVMe log queue overflow, entries dropped",
+                                entry("NVME_LOG_DROPPED=%u", droppedEntries));
+        }
+
+        for (const auto& e : pending)
+        {
+            auto message = e.message.c_str();
+            auto key = e.key.c_str();
+
+            switch (e.level)
+            {
+                case level::EMERG:
+                case level::ALERT:
+                case level::CRIT:
+                case level::ERR:
+                    sendFields<level::ERR>(message, key, e.suppressed,
+                                           e.fields, e.numFields);
+                    break;
+                case level::WARNING:
+                    sendFields<level::WARNING>(message, key, e.suppressed,
+                                               e.fields, e.numFields);
+                    break;
+                case level::NOTICE:
+                case level::INFO:
+                    sendFields<level::INFO>(message, key, e.suppressed,
+                                            e.fields, e.numFields);
+                    break;
+                default:
+                    sendFields<level::DEBUG>(message, key, e.suppressed,
+                                             e.fields, e.numFields);
+                    break;
+            }
+        }
+
+        pending.clear();
+    }
+}
+
+} // namespace nvme
+} // namespace phosphor
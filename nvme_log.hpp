@@ -0,0 +1,124 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <initializer_list>
+#include <mutex>
+#include <phosphor-logging/log.hpp>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace phosphor
+{
+namespace nvme
+{
+
+/**
+ * Structured journal field attached to a log entry
+ */
+struct LogField
+{
+    const char* name;
+    std::string value;
+};
+
+/** @class Logger
+ *  @brief Rate limited journal logging.
+ *
+ *  Entries are rate limited per key and handed to a background thread that
+ *  sends them to the journal through phosphor-logging, so the caller never
+ *  waits for the journal. Entries that exceed the rate of their key are
+ *  counted and reported with the next entry of the same key.
+ */
+class Logger
+{
+  public:
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+    Logger(Logger&&) = delete;
+    Logger& operator=(Logger&&) = delete;
+
+    /** @brief Maximum number of structured fields of one entry */
+    static constexpr size_t maxFields = 4;
+    /** @brief Maximum number of entries waiting for the journal */
+    static constexpr size_t maxQueued = 64;
+    /** @brief Entries allowed per key in each interval */
+    static constexpr unsigned burst = 5;
+    /** @brief Rate limiting interval */
+    static constexpr auto interval = std::chrono::seconds{60};
+
+    /** @brief Get the process wide logger */
+    static Logger& get();
+
+    /** @brief Queue a journal entry if its key is within the rate limit
+     *
+     * @param[in] priority - Journal priority
+     * @param[in] key      - Rate limiting key, e.g. "smbus-16"
+     * @param[in] message  - Journal message
+     * @param[in] fields   - Additional structured fields
+     */
+    void report(phosphor::logging::level priority, const std::string& key,
+                const char* message,
+                std::initializer_list<LogField> fields = {});
+
+  private:
+    Logger();
+    ~Logger();
+
+    /**
+     * Structure for keeping a queued journal entry
+     */
+    struct Entry
+    {
+        phosphor::logging::level level;
+        std::string message;
+        std::string key;
+        std::array<std::string, maxFields> fields;
+        size_t numFields;
+        unsigned suppressed;
+    };
+
+    /**
+     * Structure for keeping the rate limiting state of a key
+     */
+    struct KeyState
+    {
+        std::chrono::steady_clock::time_point windowStart;
+        unsigned count;
+        unsigned suppressed;
+    };
+
+    /** @brief Send queued entries to the journal */
+    void worker();
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Entry> queue;
+    std::unordered_map<std::string, KeyState> keys;
+    /** @brief Entries dropped because the queue was full */
+    unsigned dropped = 0;
+    bool stop = false;
+    std::thread thread;
+};
+
+/** @brief Report an error through the rate limited logger */
+inline void logError(const std::string& key, const char* message,
+                     std::initializer_list<LogField> fields = {})
+{
+    Logger::get().report(phosphor::logging::level::ERR, key, message, fields);
+}
+
+/** @brief Report an informational entry through the rate limited logger */
+inline void logInfo(const std::string& key, const char* message,
+                    std::initializer_list<LogField> fields = {})
+{
+    Logger::get().report(phosphor::logging::level::INFO, key, message,
+                         fields);
+}
+
+} // namespace nvme
+} // namespace phosphor
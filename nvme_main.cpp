@@ -1,7 +1,10 @@
+#include "i2c_trace.hpp"
 #include "nvme_manager.hpp"
 
+#include <getopt.h>
 #include <string.h>
 
+#include <cmath>
 #include <fstream>
 #include <phosphor-logging/elog-errors.hpp>
 #include <phosphor-logging/log.hpp>
@@ -10,8 +13,77 @@
 #include <sdbusplus/server/manager.hpp>
 using namespace phosphor::logging;
 
-int main(void)
+static void usage(const char* name)
 {
+    std::cerr << "Usage: " << name << " [options]\n"
+              << "  -r, --record <file>   Record all I2C transactions and "
+                 "GPIO reads to <file>\n"
+              << "  -p, --replay <file>   Replay I2C transactions and GPIO "
+                 "reads from <file>\n"
+              << "  -s, --speed <factor>  Replay speed factor, 0 replays as "
+                 "fast as possible (default 1)\n";
+}
+
+int main(int argc, char** argv)
+{
+    static const option longOptions[] = {
+        {"record", required_argument, nullptr, 'r'},
+        {"replay", required_argument, nullptr, 'p'},
+        {"speed", required_argument, nullptr, 's'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}};
+
+    std::string recordPath;
+    std::string replayPath;
+    double speed = 1;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "r:p:s:h", longOptions, nullptr)) !=
+           -1)
+    {
+        switch (opt)
+        {
+            case 'r':
+                recordPath = optarg;
+                break;
+            case 'p':
+                replayPath = optarg;
+                break;
+            case 's':
+            {
+                char* end = nullptr;
+                speed = strtod(optarg, &end);
+                if (end == optarg || *end || !std::isfinite(speed) ||
+                    speed < 0)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            }
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    if (!recordPath.empty() && !replayPath.empty())
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    auto& trace = phosphor::smbus::I2cTrace::get();
+    if (!recordPath.empty() && !trace.startRecording(recordPath))
+    {
+        std::cerr << "Can not create I2C trace " << recordPath << std::endl;
+        return 1;
+    }
+    if (!replayPath.empty() && !trace.startReplay(replayPath, speed))
+    {
+        std::cerr << "Can not load I2C trace " << replayPath << std::endl;
+        return 1;
+    }
 
     sdbusplus::bus::bus bus = sdbusplus::bus::new_default();
 
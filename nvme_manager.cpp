@@ -1,19 +1,31 @@
 #include "nvme_manager.hpp"
 
+#include "i2c_trace.hpp"
+#include "nvme_log.hpp"
+#include "nvme_tracer.hpp"
 #include "smbus.hpp"
 
+#include <algorithm>
+#include <cctype>
 #include <filesystem>
+#include <iostream>
 #include <map>
 #include <nlohmann/json.hpp>
 #include <phosphor-logging/elog-errors.hpp>
 #include <phosphor-logging/log.hpp>
 #include <sdbusplus/message.hpp>
-#include <sstream>
+#include <sdbusplus/vtable.hpp>
+#include <set>
 #include <string>
-#include <xyz/openbmc_project/Led/Physical/server.hpp>
 
 #include "i2c.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
 #define MONITOR_INTERVAL_SECONDS 1
 #define NVME_SSD_SLAVE_ADDRESS 0x6a
 #define GPIO_BASE_PATH "/sys/class/gpio/gpio"
@@ -21,25 +33,28 @@
 #define POWERGD "1"
 #define NOWARNING_STRING "ff"
 
-static constexpr auto configFile = "/etc/nvme/nvme_config.json";
 static constexpr auto delay = std::chrono::milliseconds{100};
 using Json = nlohmann::json;
 
-static constexpr const uint8_t COMMAND_CODE_0 = 0;
-static constexpr const uint8_t COMMAND_CODE_8 = 8;
-
-static constexpr int CapacityFaultMask = 1;
-static constexpr int temperatureFaultMask = 1 << 1;
-static constexpr int DegradesFaultMask = 1 << 2;
-static constexpr int MediaFaultMask = 1 << 3;
-static constexpr int BackupDeviceFaultMask = 1 << 4;
 static constexpr int NOWARNING = 255;
-
-static constexpr int SERIALNUMBER_START_INDEX = 3;
-static constexpr int SERIALNUMBER_END_INDEX = 23;
+/* Poll cycles without a replayed access that end a replay */
+static constexpr uint32_t replayIdleLimit = 3;
 
 static constexpr const int TEMPERATURE_SENSOR_FAILURE = 0x81;
 
+static constexpr const uint32_t DEFAULT_HEALTH_CACHE_TTL_SECONDS = 60;
+static constexpr const uint32_t DEFAULT_REMOVAL_DEBOUNCE_CYCLES = 3;
+static constexpr const uint32_t DEFAULT_I2C_TIMEOUT_MS = 100;
+static constexpr const uint32_t DEFAULT_I2C_RETRIES = 0;
+static constexpr const uint32_t DEFAULT_I2C_DEADLINE_MS = 500;
+static constexpr const uint32_t DEFAULT_I2C_COMMAND_RETRIES = 2;
+static constexpr const uint32_t GPIO_READ_RETRIES = 3;
+static constexpr const uint32_t DEFAULT_POWER_OFF_INTERVAL_MS = 10000;
+
+static constexpr auto powerStateOn =
+    "xyz.openbmc_project.State.Chassis.PowerState.On";
+static const std::vector<uint8_t> defaultHealthCommandCodes = {0, 8, 32};
+
 namespace fs = std::filesystem;
 
 namespace phosphor
@@ -50,102 +65,162 @@ namespace nvme
 using namespace std;
 using namespace phosphor::logging;
 
-void Nvme::setNvmeInventoryProperties(
-    const bool& present, const phosphor::nvme::Nvme::NVMeData& nvmeData,
-    const std::string& inventoryPath)
-{
-    util::SDBusPlus::setProperty(bus, INVENTORY_BUSNAME, inventoryPath,
-                                 ITEM_IFACE, "Present", present);
-    util::SDBusPlus::setProperty(bus, INVENTORY_BUSNAME, inventoryPath,
-                                 ASSET_IFACE, "Manufacturer", nvmeData.vendor);
-    util::SDBusPlus::setProperty(bus, INVENTORY_BUSNAME, inventoryPath,
-                                 ASSET_IFACE, "SerialNumber",
-                                 nvmeData.serialNumber);
-    util::SDBusPlus::setProperty(bus, INVENTORY_BUSNAME, inventoryPath,
-                                 NVME_STATUS_IFACE, "SmartWarnings",
-                                 nvmeData.smartWarnings);
-    util::SDBusPlus::setProperty(bus, INVENTORY_BUSNAME, inventoryPath,
-                                 NVME_STATUS_IFACE, "StatusFlags",
-                                 nvmeData.statusFlags);
-    util::SDBusPlus::setProperty(bus, INVENTORY_BUSNAME, inventoryPath,
-                                 NVME_STATUS_IFACE, "DriveLifeUsed",
-                                 nvmeData.driveLifeUsed);
-
-    auto smartWarning = (!nvmeData.smartWarnings.empty())
-                            ? std::stoi(nvmeData.smartWarnings, 0, 16)
-                            : NOWARNING;
-
-    util::SDBusPlus::setProperty(bus, INVENTORY_BUSNAME, inventoryPath,
-                                 NVME_STATUS_IFACE, "CapacityFault",
-                                 !(smartWarning & CapacityFaultMask));
-
-    util::SDBusPlus::setProperty(bus, INVENTORY_BUSNAME, inventoryPath,
-                                 NVME_STATUS_IFACE, "TemperatureFault",
-                                 !(smartWarning & temperatureFaultMask));
-
-    util::SDBusPlus::setProperty(bus, INVENTORY_BUSNAME, inventoryPath,
-                                 NVME_STATUS_IFACE, "DegradesFault",
-                                 !(smartWarning & DegradesFaultMask));
-
-    util::SDBusPlus::setProperty(bus, INVENTORY_BUSNAME, inventoryPath,
-                                 NVME_STATUS_IFACE, "MediaFault",
-                                 !(smartWarning & MediaFaultMask));
-
-    util::SDBusPlus::setProperty(bus, INVENTORY_BUSNAME, inventoryPath,
-                                 NVME_STATUS_IFACE, "BackupDeviceFault",
-                                 !(smartWarning & BackupDeviceFaultMask));
-}
-
-void Nvme::setFaultLED(const std::string& locateLedGroupPath,
-                       const std::string& faultLedGroupPath,
-                       const bool& request)
-{
-    if (locateLedGroupPath.empty() || faultLedGroupPath.empty())
+Nvme::~Nvme()
+{
+    // Joining the worker of an isolated bus would block the exit for as
+    // long as its transfer hangs. It is detached and the bus and drives it
+    // may still write to are leaked; moving the map keeps its nodes.
+    bool leakDrives = false;
+    for (auto& [busID, nvmeBus] : buses)
     {
-        return;
+        if (nvmeBus->hung())
+        {
+            nvmeBus->detach();
+            nvmeBus.release();
+            leakDrives = true;
+        }
+    }
+    if (leakDrives)
+    {
+        new std::unordered_map<std::string, NVMeDrive>(std::move(drives));
     }
 
-    // Before toggle LED, check whether is Identify or not.
-    if (!getLEDGroupState(locateLedGroupPath))
+    for (const auto& [path, fd] : gpioFds)
     {
-        util::SDBusPlus::setProperty(bus, LED_GROUP_BUSNAME, faultLedGroupPath,
-                                     LED_GROUP_IFACE, "Asserted", request);
+        close(fd);
     }
 }
 
-void Nvme::setLocateLED(const std::string& locateLedGroupPath,
-                        const std::string& locateLedBusName,
-                        const std::string& locateLedPath, const bool& isPresent)
+/** @brief SMART warning bits of a drive, a set bit means no warning,
+ *         a value that is not hexadecimal reads as no warning
+ */
+static int smartWarningBits(const std::string& smartWarnings)
 {
-    if (locateLedGroupPath.empty() || locateLedBusName.empty() ||
-        locateLedPath.empty())
+    if (smartWarnings.empty())
     {
-        return;
+        return NOWARNING;
     }
 
-    namespace server = sdbusplus::xyz::openbmc_project::Led::server;
+    char* end = nullptr;
+    errno = 0;
+    auto bits = strtol(smartWarnings.c_str(), &end, 16);
+    if (errno || *end || bits < 0 || bits > 0xff)
+    {
+        return NOWARNING;
+    }
 
-    if (!getLEDGroupState(locateLedGroupPath))
+    return bits;
+}
+
+bool Nvme::setNvmeInventoryProperties(
+    const phosphor::nvme::Nvme::NVMeConfig& config, const bool& present,
+    const phosphor::nvme::Nvme::NVMeData& nvmeData)
+{
+    NvmeTracer::Span span("inventory", config.index.c_str());
+    auto smartWarning = smartWarningBits(nvmeData.smartWarnings);
+    const auto& faults = config.layout->faults;
+
+    if (inventoryMode == InventoryMode::Local)
     {
-        if (isPresent)
-            util::SDBusPlus::setProperty(
-                bus, locateLedBusName, locateLedPath, LED_CONTROLLER_IFACE,
-                "State",
-                server::convertForMessage(server::Physical::Action::On));
-        else
-            util::SDBusPlus::setProperty(
-                bus, locateLedBusName, locateLedPath, LED_CONTROLLER_IFACE,
-                "State",
-                server::convertForMessage(server::Physical::Action::Off));
+        // In-process writes, the setters only signal what changed.
+        auto& inventory = *drives[config.index].inventory;
+
+        inventory.ItemInterface::present(present);
+        inventory.AssetInterface::manufacturer(nvmeData.vendor);
+        inventory.AssetInterface::serialNumber(nvmeData.serialNumber);
+        inventory.StatusInterface::smartWarnings(nvmeData.smartWarnings);
+        inventory.StatusInterface::statusFlags(nvmeData.statusFlags);
+        inventory.StatusInterface::driveLifeUsed(nvmeData.driveLifeUsed);
+        inventory.StatusInterface::capacityFault(
+            !(smartWarning & faults.capacity));
+        inventory.StatusInterface::temperatureFault(
+            !(smartWarning & faults.temperature));
+        inventory.StatusInterface::degradesFault(
+            !(smartWarning & faults.degrades));
+        inventory.StatusInterface::mediaFault(!(smartWarning & faults.media));
+        inventory.StatusInterface::backupDeviceFault(
+            !(smartWarning & faults.backupDevice));
+
+        return true;
     }
+
+    auto& drive = drives[config.index];
+    const auto& item = drive.itemTarget;
+    const auto& asset = drive.assetTarget;
+    const auto& status = drive.statusTarget;
+    auto& calls = drive.inventoryCalls;
+    auto failed = 0;
+
+    // The replies are not waited for, a failed one invalidates the drive.
+    calls.begin();
+
+    failed |= calls.setProperty(bus, item, "Present", present);
+    failed |= calls.setProperty(bus, asset, "Manufacturer", nvmeData.vendor);
+    failed |= calls.setProperty(bus, asset, "SerialNumber",
+                                nvmeData.serialNumber);
+    failed |= calls.setProperty(bus, status, "SmartWarnings",
+                                nvmeData.smartWarnings);
+    failed |= calls.setProperty(bus, status, "StatusFlags",
+                                nvmeData.statusFlags);
+    failed |= calls.setProperty(bus, status, "DriveLifeUsed",
+                                nvmeData.driveLifeUsed);
+
+    failed |= calls.setProperty(bus, status, "CapacityFault",
+                                !(smartWarning & faults.capacity));
+
+    failed |= calls.setProperty(bus, status, "TemperatureFault",
+                                !(smartWarning & faults.temperature));
+
+    failed |= calls.setProperty(bus, status, "DegradesFault",
+                                !(smartWarning & faults.degrades));
+
+    failed |= calls.setProperty(bus, status, "MediaFault",
+                                !(smartWarning & faults.media));
+
+    failed |= calls.setProperty(bus, status, "BackupDeviceFault",
+                                !(smartWarning & faults.backupDevice));
+
+    return !failed;
 }
 
-bool Nvme::getLEDGroupState(const std::string& ledPath)
+void Nvme::publishInventory(const phosphor::nvme::Nvme::NVMeConfig& config,
+                            bool present,
+                            const phosphor::nvme::Nvme::NVMeData& nvmeData)
 {
-    auto asserted = util::SDBusPlus::getProperty<bool>(
-        bus, LED_GROUP_BUSNAME, ledPath, LED_GROUP_IFACE, "Asserted");
+    auto& drive = drives[config.index];
+    auto& published = drive.published;
+
+    if (drive.inventoryValid && published.present == present &&
+        published.vendor == nvmeData.vendor &&
+        published.serialNumber == nvmeData.serialNumber &&
+        published.smartWarnings == nvmeData.smartWarnings &&
+        published.statusFlags == nvmeData.statusFlags &&
+        published.driveLifeUsed == nvmeData.driveLifeUsed)
+    {
+        return;
+    }
+
+    // A failed Set is retried in the next cycle.
+    drive.inventoryValid =
+        setNvmeInventoryProperties(config, present, nvmeData);
+
+    published.present = present;
+    published.vendor = nvmeData.vendor;
+    published.serialNumber = nvmeData.serialNumber;
+    published.smartWarnings = nvmeData.smartWarnings;
+    published.statusFlags = nvmeData.statusFlags;
+    published.driveLifeUsed = nvmeData.driveLifeUsed;
+}
 
-    return asserted;
+void Nvme::setLEDs(const phosphor::nvme::Nvme::NVMeConfig& config,
+                   bool fault, bool locate)
+{
+    auto led = leds.find(config.index);
+    if (led != leds.end())
+    {
+        NvmeTracer::Span span("leds", config.index.c_str());
+        led->second->request(fault, locate);
+    }
 }
 
 void Nvme::setLEDsStatus(const phosphor::nvme::Nvme::NVMeConfig& config,
@@ -163,11 +238,7 @@ void Nvme::setLEDsStatus(const phosphor::nvme::Nvme::NVMeConfig& config,
                     ? false
                     : true;
 
-            setFaultLED(config.locateLedGroupPath, config.faultLedGroupPath,
-                        request);
-            setLocateLED(config.locateLedGroupPath,
-                         config.locateLedControllerBusName,
-                         config.locateLedControllerPath, !request);
+            setLEDs(config, request, !request);
         }
         isError[config.index] = false;
     }
@@ -176,136 +247,383 @@ void Nvme::setLEDsStatus(const phosphor::nvme::Nvme::NVMeConfig& config,
         if (isError[config.index] != true)
         {
             // Drive is present but can not get data, turn on fault LED.
-            std::cerr << "Drive status is good but can not get data. index = "
-                      << config.index << std::endl;
+            logError("drive-data-" + config.index,
+                     "Drive status is good but can not get data",
+                     {{"NVME_INDEX", config.index}});
             isError[config.index] = true;
         }
 
-        setFaultLED(config.locateLedGroupPath, config.faultLedGroupPath, true);
-        setLocateLED(config.locateLedGroupPath,
-                     config.locateLedControllerBusName,
-                     config.locateLedControllerPath, false);
+        setLEDs(config, true, false);
     }
 }
 
-std::string intToHex(int input)
+/** @brief Format a byte as hex into a reused string  */
+static void intToHex(int input, std::string& output)
 {
-    std::stringstream tmp;
-    tmp << std::hex << input;
+    char buf[sizeof("ff")];
+    auto len = snprintf(buf, sizeof(buf), "%x", input & 0xff);
 
-    return tmp.str();
+    output.assign(buf, len);
 }
 
-/** @brief Get NVMe info over smbus  */
-bool getNVMeInfobyBusID(int busID, phosphor::nvme::Nvme::NVMeData& nvmeData)
+/** @brief Clear the NVMe info, keeping the capacity of its strings  */
+static void clearNVMeData(phosphor::nvme::Nvme::NVMeData& nvmeData)
 {
-    nvmeData.present = true;
-    nvmeData.vendor = "";
-    nvmeData.serialNumber = "";
-    nvmeData.smartWarnings = "";
-    nvmeData.statusFlags = "";
-    nvmeData.driveLifeUsed = "";
-    nvmeData.sensorValue = (int8_t)TEMPERATURE_SENSOR_FAILURE;
+    nvmeData.present = false;
+    nvmeData.vendor.clear();
+    nvmeData.serialNumber.clear();
+    nvmeData.smartWarnings.clear();
+    nvmeData.statusFlags.clear();
+    nvmeData.driveLifeUsed.clear();
+    nvmeData.sensorValue = 0;
+}
 
-    phosphor::smbus::Smbus smbus;
+/** @brief Decode the NVMe info read over smbus with a layout, the fields
+ *         are read with direct loads as their positions are constant
+ */
+template <typename Layout>
+static void decodeNVMeInfo(const NvmeBus::Transaction& poll,
+                           phosphor::nvme::Nvme::NVMeData& nvmeData)
+{
+    static_assert(fieldFits<Layout>(Layout::statusFlags) &&
+                      fieldFits<Layout>(Layout::smartWarnings) &&
+                      fieldFits<Layout>(Layout::temperature) &&
+                      fieldFits<Layout>(Layout::driveLifeUsed) &&
+                      fieldFits<Layout>(Layout::vendor) &&
+                      fieldFits<Layout>(Layout::serialNumber),
+                  "Field outside the block length of its command");
+    static_assert(Layout::statusFlags.length == 1 &&
+                      Layout::smartWarnings.length == 1 &&
+                      Layout::temperature.length == 1 &&
+                      Layout::driveLifeUsed.length == 1 &&
+                      (Layout::vendor.length == 2 ||
+                       Layout::vendor.length == 0),
+                  "Unsupported field length");
+
+    auto byteAt = [&poll](const Field& field, size_t i = 0) {
+        return poll.responses[field.block][field.offset + i];
+    };
+
+    // Format into the reused strings of the drive, an unchanged drive
+    // fits their capacity.
+    // A field the layout does not read stays empty.
+    if constexpr (Layout::vendor.length != 0)
+    {
+        char vendor[sizeof("ff ff")];
+        auto len = snprintf(vendor, sizeof(vendor), "%x %x",
+                            byteAt(Layout::vendor), byteAt(Layout::vendor, 1));
+        nvmeData.vendor.assign(vendor, len);
+    }
 
-    unsigned char rsp_data_command_0[I2C_DATA_MAX] = {0};
-    unsigned char rsp_data_command_8[I2C_DATA_MAX] = {0};
+    if constexpr (Layout::serialNumber.length != 0)
+    {
+        nvmeData.serialNumber.assign(
+            reinterpret_cast<const char*>(
+                poll.responses[Layout::serialNumber.block].data()) +
+                Layout::serialNumber.offset,
+            Layout::serialNumber.length);
+    }
 
-    uint8_t tx_data = COMMAND_CODE_0;
+    intToHex(byteAt(Layout::statusFlags), nvmeData.statusFlags);
+    intToHex(byteAt(Layout::smartWarnings), nvmeData.smartWarnings);
+    intToHex(byteAt(Layout::driveLifeUsed), nvmeData.driveLifeUsed);
+    nvmeData.sensorValue = (int8_t)byteAt(Layout::temperature);
+}
 
-    auto init = smbus.smbusInit(busID);
+/** @brief Runtime descriptor of a layout */
+template <typename Layout>
+static Nvme::Layout describeLayout()
+{
+    return {Layout::name,
+            {Layout::commandCodes.begin(), Layout::commandCodes.end()},
+            {Layout::blockLengths.begin(), Layout::blockLengths.end()},
+            Layout::faults, decodeNVMeInfo<Layout>};
+}
+
+/** @brief Layouts selectable by NVMeDriveLayout, the first is the default */
+static const std::vector<Nvme::Layout> layouts = {
+    describeLayout<BasicLayout>(),
+    describeLayout<StatusLayout>(),
+};
+
+/** @brief Decode the NVMe info read over smbus
+ *
+ * @param[in]     busID      - I2C bus of the drive
+ * @param[in]     layout     - Response layout of the drive
+ * @param[in]     poll       - Completed poll of the drive
+ * @param[out]    nvmeData   - Decoded drive data
+ * @param[in,out] smbusError - Whether the last failure of the drive was
+ *                             logged, several drives may share a bus
+ */
+static bool parseNVMeInfo(int busID, const Nvme::Layout& layout,
+                          const NvmeBus::Transaction& poll,
+                          phosphor::nvme::Nvme::NVMeData& nvmeData,
+                          bool& smbusError)
+{
+    clearNVMeData(nvmeData);
+    nvmeData.sensorValue = (int8_t)TEMPERATURE_SENSOR_FAILURE;
 
-    static std::unordered_map<int, bool> isErrorSmbus;
+    // The bus reports the transaction that missed its deadline.
+    if (poll.timedOut)
+    {
+        return nvmeData.present;
+    }
 
-    if (init == -1)
+    if (!poll.opened)
     {
-        if (isErrorSmbus[busID] != true)
+        if (!smbusError)
         {
-            std::cerr << "smbusInit fail!" << std::endl;
-            isErrorSmbus[busID] = true;
+            logError("smbus-" + std::to_string(busID), "smbusInit fail",
+                     {{"I2C_BUS", std::to_string(busID)}});
+            smbusError = true;
         }
 
-        nvmeData.present = false;
-
         return nvmeData.present;
     }
 
-    auto res_int =
-        smbus.SendSmbusRWBlockCmdRAW(busID, NVME_SSD_SLAVE_ADDRESS, &tx_data,
-                                     sizeof(tx_data), rsp_data_command_0);
-
-    if (res_int < 0)
+    for (size_t i = 0; i < poll.commandCodes.size(); ++i)
     {
-        if (isErrorSmbus[busID] != true)
+        if (poll.results[i] < 0)
         {
-            std::cerr << "Send command code 0 fail!" << std::endl;
-            isErrorSmbus[busID] = true;
-        }
+            if (!smbusError)
+            {
+                logError("smbus-" + std::to_string(busID) + "-" +
+                             std::to_string(poll.address),
+                         "Send command code fail",
+                         {{"I2C_BUS", std::to_string(busID)},
+                          {"I2C_ADDRESS", std::to_string(poll.address)},
+                          {"COMMAND_CODE",
+                           std::to_string(poll.commandCodes[i])},
+                          {"ERRNO", std::to_string(-poll.results[i])}});
+                smbusError = true;
+            }
 
-        smbus.smbusClose(busID);
-        nvmeData.present = false;
-        return nvmeData.present;
+            return nvmeData.present;
+        }
     }
 
-    tx_data = COMMAND_CODE_8;
+    nvmeData.present = true;
+    layout.decode(poll, nvmeData);
+
+    smbusError = false;
 
-    res_int =
-        smbus.SendSmbusRWBlockCmdRAW(busID, NVME_SSD_SLAVE_ADDRESS, &tx_data,
-                                     sizeof(tx_data), rsp_data_command_8);
+    return nvmeData.present;
+}
 
-    if (res_int < 0)
+void Nvme::run()
+{
+    init();
+
+    try
     {
-        if (isErrorSmbus[busID] != true)
-        {
-            std::cerr << "Send command code 8 fail!" << std::endl;
-            isErrorSmbus[busID] = true;
-        }
+        restartTimer();
+    }
+    catch (const std::exception& e)
+    {
+        logError("poll-timer", "Error in polling loop",
+                 {{"ERROR", e.what()}});
+    }
+}
 
-        smbus.smbusClose(busID);
-        nvmeData.present = false;
-        return nvmeData.present;
+void Nvme::restartTimer()
+{
+    auto period = hostOn ? polling.interval : polling.powerOffInterval;
+    u_int64_t interval = period.count() * 1000;
+
+    // Replay the recorded cycles at the requested speed.
+    auto& trace = phosphor::smbus::I2cTrace::get();
+    if (trace.mode() == phosphor::smbus::I2cTrace::Mode::Replay)
+    {
+        interval = (trace.speed() > 0) ? interval / trace.speed() : 1000;
+    }
+    pollInterval = std::chrono::microseconds(interval);
+
+    // In staggered mode the timer fires once per drive slot.
+    if (polling.staggered && !configs.empty())
+    {
+        interval = std::max<u_int64_t>(interval / configs.size(), 1);
     }
 
-    nvmeData.vendor =
-        intToHex(rsp_data_command_8[1]) + " " + intToHex(rsp_data_command_8[2]);
+    _timer.restart(std::chrono::microseconds(interval));
+}
+
+static const sdbusplus::vtable::vtable_t managerVtable[] = {
+    sdbusplus::vtable::start(),
+    sdbusplus::vtable::method("GetDrives", "", "a{sa{sv}}", Nvme::getDrives),
+    sdbusplus::vtable::method("SetTracing", "b", "", Nvme::setTracing),
+    sdbusplus::vtable::method("DumpTrace", "", "s", Nvme::dumpTrace),
+    sdbusplus::vtable::end()};
+
+void Nvme::createManagerInterface()
+{
+    managerIface = std::make_unique<sdbusplus::server::interface::interface>(
+        bus, NVME_MANAGER_PATH, NVME_MANAGER_IFACE, managerVtable, this);
+}
+
+int Nvme::getDrives(sd_bus_message* msg, void* context, sd_bus_error* error)
+{
+    using Value = sdbusplus::message::variant<bool, uint64_t, double,
+                                              std::string>;
+    using Properties = std::map<std::string, Value>;
 
-    for (int offset = SERIALNUMBER_START_INDEX; offset < SERIALNUMBER_END_INDEX;
-         offset++)
+    auto nvme = static_cast<Nvme*>(context);
+    std::map<std::string, Properties> result;
+
+    // Everything is served from the state last published by the poll
+    // cycles, no drive is accessed.
+    for (const auto& config : nvme->configs)
     {
-        nvmeData.serialNumber += static_cast<char>(rsp_data_command_8[offset]);
+        const auto& drive = nvme->drives[config.index];
+        const auto& published = drive.published;
+        auto smartWarning = smartWarningBits(published.smartWarnings);
+        const auto& faults = config.layout->faults;
+
+        auto& properties = result[config.index];
+        properties = {
+            {"Present", published.present},
+            {"Manufacturer", published.vendor},
+            {"SerialNumber", published.serialNumber},
+            {"SmartWarnings", published.smartWarnings},
+            {"StatusFlags", published.statusFlags},
+            {"DriveLifeUsed", published.driveLifeUsed},
+            {"CapacityFault", !(smartWarning & faults.capacity)},
+            {"TemperatureFault", !(smartWarning & faults.temperature)},
+            {"DegradesFault", !(smartWarning & faults.degrades)},
+            {"MediaFault", !(smartWarning & faults.media)},
+            {"BackupDeviceFault", !(smartWarning & faults.backupDevice)},
+            {"Timestamp", drive.sampleTimestamp},
+        };
+
+        auto sensor = nvme->nvmes.find(config.index);
+        if (sensor != nvme->nvmes.end())
+        {
+            const auto& ssd = *sensor->second;
+
+            properties.emplace("Temperature", ssd.ValueIface::value());
+            properties.emplace("Available",
+                               ssd.AvailabilityInterface::available());
+            properties.emplace("Functional",
+                               ssd.OperationalStatusInterface::functional());
+            properties.emplace("CriticalAlarmHigh",
+                               ssd.CriticalInterface::criticalAlarmHigh());
+            properties.emplace("CriticalAlarmLow",
+                               ssd.CriticalInterface::criticalAlarmLow());
+            properties.emplace("WarningAlarmHigh",
+                               ssd.WarningInterface::warningAlarmHigh());
+            properties.emplace("WarningAlarmLow",
+                               ssd.WarningInterface::warningAlarmLow());
+        }
     }
 
-    nvmeData.statusFlags = intToHex(rsp_data_command_0[1]);
-    nvmeData.smartWarnings = intToHex(rsp_data_command_0[2]);
-    nvmeData.driveLifeUsed = intToHex(rsp_data_command_0[4]);
-    nvmeData.sensorValue = (int8_t)rsp_data_command_0[3];
+    sdbusplus::message::message call(msg);
+    auto reply = call.new_method_return();
+    reply.append(result);
+    reply.method_return();
 
-    smbus.smbusClose(busID);
+    return 1;
+}
 
-    isErrorSmbus[busID] = false;
+int Nvme::setTracing(sd_bus_message* msg, void* context, sd_bus_error* error)
+{
+    sdbusplus::message::message call(msg);
+    bool on;
+    call.read(on);
 
-    return nvmeData.present;
+    NvmeTracer::get().enable(on);
+    logInfo("poll-trace", on ? "Poll cycle tracing on"
+                             : "Poll cycle tracing off");
+
+    auto reply = call.new_method_return();
+    reply.method_return();
+
+    return 1;
 }
 
-void Nvme::run()
+int Nvme::dumpTrace(sd_bus_message* msg, void* context, sd_bus_error* error)
 {
-    init();
+    sdbusplus::message::message call(msg);
+
+    auto path = NvmeTracer::get().dump();
+    if (path.empty())
+    {
+        return sd_bus_error_set_errno(error, errno);
+    }
+
+    auto reply = call.new_method_return();
+    reply.append(path);
+    reply.method_return();
+
+    return 1;
+}
+
+void Nvme::createPowerMatch()
+{
+    if (polling.powerOffInterval.count() <= 0)
+    {
+        return;
+    }
+
+    powerMatch = std::make_unique<sdbusplus::bus::match::match>(
+        bus,
+        sdbusplus::bus::match::rules::propertiesChanged(CHASSIS_STATE_PATH,
+                                                        CHASSIS_STATE_IFACE),
+        [this](sdbusplus::message::message& msg) {
+            std::string interface;
+            std::map<std::string, sdbusplus::message::variant<std::string>>
+                properties;
+
+            msg.read(interface, properties);
+
+            auto state = properties.find("CurrentPowerState");
+            if (state != properties.end())
+            {
+                setPowerState(sdbusplus::message::variant_ns::get<std::string>(
+                    state->second));
+            }
+        });
 
-    std::function<void()> callback(std::bind(&Nvme::read, this));
     try
     {
-        u_int64_t interval = MONITOR_INTERVAL_SECONDS * 1000000;
-        _timer.restart(std::chrono::microseconds(interval));
+        auto methodCall = bus.new_method_call(
+            CHASSIS_STATE_BUSNAME, CHASSIS_STATE_PATH, DBUS_PROPERTY_IFACE,
+            "Get");
+        methodCall.append(CHASSIS_STATE_IFACE, "CurrentPowerState");
+
+        sdbusplus::message::variant<std::string> state;
+        auto reply = bus.call(methodCall);
+        reply.read(state);
+
+        hostOn = (sdbusplus::message::variant_ns::get<std::string>(state) ==
+                  powerStateOn);
     }
     catch (const std::exception& e)
     {
-        std::cerr << "Error in polling loop. ERROR = " << e.what() << std::endl;
+        // Poll at full rate until the power state is known.
+        logError("power-state", "Can not get chassis power state",
+                 {{"ERROR", e.what()}});
     }
 }
 
+void Nvme::setPowerState(const std::string& state)
+{
+    auto on = (state == powerStateOn);
+    if (on == hostOn)
+    {
+        return;
+    }
+
+    hostOn = on;
+    logInfo("power-state",
+            on ? "Host powered on, polling NVMe drives"
+               : "Host powered off, polling NVMe drive presence only",
+            {{"POWER_STATE", state}});
+
+    // Switch to the period of the new mode right away.
+    restartTimer();
+}
+
 /** @brief Parsing NVMe config JSON file  */
-Json parseSensorConfig()
+static Json parseSensorConfig(const std::string& configFile)
 {
     std::ifstream jsonFile(configFile);
     if (!jsonFile.is_open())
@@ -334,10 +652,12 @@ std::vector<phosphor::nvme::Nvme::NVMeConfig> Nvme::getNvmeConfig()
     int8_t minValue = 0;
     int8_t warningHigh = 0;
     int8_t warningLow = 0;
+    uint32_t healthCacheTTL = DEFAULT_HEALTH_CACHE_TTL_SECONDS;
+    std::vector<uint8_t> healthCommandCodes = defaultHealthCommandCodes;
 
     try
     {
-        auto data = parseSensorConfig();
+        auto data = parseSensorConfig(configFile);
         static const std::vector<Json> empty{};
         std::vector<Json> readings = data.value("config", empty);
         std::vector<Json> thresholds = data.value("threshold", empty);
@@ -359,12 +679,19 @@ std::vector<phosphor::nvme::Nvme::NVMeConfig> Nvme::getNvmeConfig()
                       << std::endl;
         }
 
+        auto health = data.value("extendedHealth", Json::object());
+        healthCacheTTL = health.value("cacheTTL", healthCacheTTL);
+        healthCommandCodes =
+            health.value("commandCodes", healthCommandCodes);
+
         if (!readings.empty())
         {
             for (const auto& instance : readings)
             {
                 uint8_t index = instance.value("NVMeDriveIndex", 0);
-                uint8_t busID = instance.value("NVMeDriveBusID", 0);
+                int busID = instance.value("NVMeDriveBusID", 0);
+                uint8_t address = instance.value("NVMeDriveSlaveAddress",
+                                                 NVME_SSD_SLAVE_ADDRESS);
                 std::string faultLedGroupPath =
                     instance.value("NVMeDriveFaultLEDGroupPath", "");
                 std::string locateLedGroupPath =
@@ -375,9 +702,20 @@ std::vector<phosphor::nvme::Nvme::NVMeConfig> Nvme::getNvmeConfig()
                     instance.value("NVMeDriveLocateLEDControllerBusName", "");
                 std::string locateLedControllerPath =
                     instance.value("NVMeDriveLocateLEDControllerPath", "");
+                std::string layoutName =
+                    instance.value("NVMeDriveLayout", layouts.front().name);
+
+                if (!phosphor::smbus::Smbus::validBus(busID))
+                {
+                    std::cerr << "NVMe drive " << (int)index << " bus ID "
+                              << busID << " out of range, drive skipped"
+                              << std::endl;
+                    continue;
+                }
 
                 nvmeConfig.index = std::to_string(index);
                 nvmeConfig.busID = busID;
+                nvmeConfig.address = address;
                 nvmeConfig.faultLedGroupPath = faultLedGroupPath;
                 nvmeConfig.presentPin = presentPin;
                 nvmeConfig.pwrGoodPin = pwrGoodPin;
@@ -391,6 +729,29 @@ std::vector<phosphor::nvme::Nvme::NVMeConfig> Nvme::getNvmeConfig()
                 nvmeConfig.warningLow = warningLow;
                 nvmeConfig.maxValue = maxValue;
                 nvmeConfig.minValue = minValue;
+                nvmeConfig.healthCacheTTL =
+                    std::chrono::seconds(healthCacheTTL);
+                nvmeConfig.healthCommandCodes = healthCommandCodes;
+                nvmeConfig.presentPath = GPIO_BASE_PATH +
+                                         std::to_string(presentPin) + "/value";
+                nvmeConfig.pwrGoodPath = GPIO_BASE_PATH +
+                                         std::to_string(pwrGoodPin) + "/value";
+                nvmeConfig.inventoryPath =
+                    NVME_INVENTORY_PATH + nvmeConfig.index;
+                nvmeConfig.objPath = NVME_OBJ_PATH + nvmeConfig.index;
+
+                auto layout = std::find_if(layouts.begin(), layouts.end(),
+                                           [&layoutName](const auto& l) {
+                                               return l.name == layoutName;
+                                           });
+                if (layout == layouts.end())
+                {
+                    std::cerr << "Unknown NVMe layout " << layoutName
+                              << ", using " << layouts.front().name
+                              << std::endl;
+                    layout = layouts.begin();
+                }
+                nvmeConfig.layout = &*layout;
                 nvmeConfigs.push_back(nvmeConfig);
             }
         }
@@ -408,34 +769,210 @@ std::vector<phosphor::nvme::Nvme::NVMeConfig> Nvme::getNvmeConfig()
     return nvmeConfigs;
 }
 
+/** @brief Obtain the polling configuration  */
+Nvme::PollingConfig Nvme::getPollingConfig()
+{
+    PollingConfig config{std::chrono::seconds(MONITOR_INTERVAL_SECONDS), false,
+                         PollingConfig::CatchUp::Slip,
+                         DEFAULT_REMOVAL_DEBOUNCE_CYCLES,
+                         std::chrono::milliseconds(
+                             DEFAULT_POWER_OFF_INTERVAL_MS)};
+
+    try
+    {
+        auto data = parseSensorConfig(configFile);
+        auto polling = data.value("polling", Json::object());
+
+        config.interval = std::chrono::milliseconds(
+            polling.value("interval", config.interval.count()));
+        config.staggered = polling.value("staggered", config.staggered);
+        if (polling.value("catchUp", "slip") == "burst")
+        {
+            config.catchUp = PollingConfig::CatchUp::Burst;
+        }
+        config.removalDebounce =
+            polling.value("removalDebounce", config.removalDebounce);
+        config.powerOffInterval = std::chrono::milliseconds(polling.value(
+            "powerOffInterval", config.powerOffInterval.count()));
+    }
+    catch (const Json::exception& e)
+    {
+        std::cerr << "Json Exception caught. MSG: " << e.what() << std::endl;
+    }
+
+    if (config.interval.count() <= 0)
+    {
+        config.interval = std::chrono::seconds(MONITOR_INTERVAL_SECONDS);
+    }
+
+    return config;
+}
+
+/** @brief Obtain where the inventory interfaces are hosted  */
+Nvme::InventoryMode Nvme::getInventoryMode()
+{
+    auto mode = InventoryMode::Remote;
+
+    try
+    {
+        auto data = parseSensorConfig(configFile);
+        auto inventory = data.value("inventory", Json::object());
+
+        if (inventory.value("mode", "remote") == "local")
+        {
+            mode = InventoryMode::Local;
+        }
+    }
+    catch (const Json::exception& e)
+    {
+        std::cerr << "Json Exception caught. MSG: " << e.what() << std::endl;
+    }
+
+    return mode;
+}
+
+/** @brief Obtain the I2C settings of a bus  */
+NvmeBus::Settings Nvme::getBusSettings(uint8_t busID)
+{
+    NvmeBus::Settings settings{
+        std::chrono::milliseconds(DEFAULT_I2C_TIMEOUT_MS), DEFAULT_I2C_RETRIES,
+        std::chrono::milliseconds(DEFAULT_I2C_DEADLINE_MS), false,
+        DEFAULT_I2C_COMMAND_RETRIES};
+
+    auto apply = [&settings](const Json& values) {
+        settings.timeout = std::chrono::milliseconds(
+            values.value("timeout", settings.timeout.count()));
+        settings.retries = values.value("retries", settings.retries);
+        settings.deadline = std::chrono::milliseconds(
+            values.value("deadline", settings.deadline.count()));
+        settings.pec = values.value("pec", settings.pec);
+        settings.commandRetries =
+            values.value("commandRetries", settings.commandRetries);
+    };
+
+    try
+    {
+        auto data = parseSensorConfig(configFile);
+        auto i2c = data.value("i2c", Json::object());
+        static const std::vector<Json> empty{};
+
+        apply(i2c);
+        for (const auto& instance : i2c.value("buses", empty))
+        {
+            if (instance.value("busID", -1) == busID)
+            {
+                apply(instance);
+            }
+        }
+    }
+    catch (const Json::exception& e)
+    {
+        std::cerr << "Json Exception caught. MSG: " << e.what() << std::endl;
+    }
+
+    return settings;
+}
+
+/** @brief Obtain the thermal zones of drives  */
+std::vector<Nvme::ThermalZone> Nvme::getThermalZones()
+{
+    std::vector<ThermalZone> zones;
+
+    try
+    {
+        auto data = parseSensorConfig(configFile);
+        static const std::vector<Json> empty{};
+        std::vector<Json> instances = data.value("thermalZones", empty);
+
+        for (const auto& instance : instances)
+        {
+            ThermalZone zone;
+
+            zone.name = instance.value("name", "");
+            // The name becomes part of the sensor object paths.
+            std::replace_if(
+                zone.name.begin(), zone.name.end(),
+                [](char c) { return !isalnum(static_cast<unsigned char>(c)); },
+                '_');
+
+            for (uint8_t index :
+                 instance.value("drives", std::vector<uint8_t>()))
+            {
+                zone.drives.push_back(std::to_string(index));
+            }
+
+            if (zone.name.empty() || zone.drives.empty())
+            {
+                std::cerr << "Invalid NVMe thermal zone, name or drives "
+                             "dosen't exist"
+                          << std::endl;
+                continue;
+            }
+
+            zones.push_back(std::move(zone));
+        }
+    }
+    catch (const Json::exception& e)
+    {
+        std::cerr << "Json Exception caught. MSG: " << e.what() << std::endl;
+    }
+
+    return zones;
+}
+
 std::string Nvme::getGPIOValueOfNvme(const std::string& fullPath)
 {
     std::string val;
-    std::ifstream ifs;
-    auto retries = 3;
+    char buf[8];
+    ssize_t len = -1;
 
-    while (retries != 0)
+    auto& trace = phosphor::smbus::I2cTrace::get();
+    if (trace.mode() == phosphor::smbus::I2cTrace::Mode::Replay)
     {
-        try
+        return trace.replayGpio(fullPath);
+    }
+
+    // The value file stays open, a poll is a single pread.
+    auto fd = gpioFds.find(fullPath);
+    if (fd == gpioFds.end())
+    {
+        auto newFd = open(fullPath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (newFd >= 0)
         {
-            if (!ifs.is_open())
-                ifs.open(fullPath);
-            ifs.clear();
-            ifs.seekg(0);
-            ifs >> val;
+            fd = gpioFds.emplace(fullPath, newFd).first;
         }
-        catch (const std::exception& e)
+        else
         {
-            --retries;
-            std::this_thread::sleep_for(delay);
-            std::cerr << "Can not open gpio path MSG: " << e.what()
-                      << std::endl;
-            continue;
+            logError("gpio-" + fullPath, "Can not open gpio path",
+                     {{"GPIO_PATH", fullPath}, {"ERROR", strerror(errno)}});
+        }
+    }
+
+    if (fd != gpioFds.end())
+    {
+        len = pread(fd->second, buf, sizeof(buf), 0);
+        if (len < 0)
+        {
+            logError("gpio-" + fullPath, "Can not read gpio path",
+                     {{"GPIO_PATH", fullPath}, {"ERROR", strerror(errno)}});
+            close(fd->second);
+            gpioFds.erase(fd);
         }
-        break;
     }
 
-    ifs.close();
+    // Take the first word of the value, e.g. "1" of "1\n".
+    ssize_t end = 0;
+    while (end < len && !isspace(static_cast<unsigned char>(buf[end])))
+    {
+        ++end;
+    }
+    val.assign(buf, end);
+
+    if (trace.mode() == phosphor::smbus::I2cTrace::Mode::Record)
+    {
+        trace.recordGpio(fullPath, val);
+    }
+
     return val;
 }
 
@@ -448,6 +985,25 @@ void Nvme::createNVMeInventory()
     std::string inventoryPath;
     std::map<sdbusplus::message::object_path, Interfaces> obj;
 
+    if (inventoryMode == InventoryMode::Local)
+    {
+        inventoryObjManager =
+            std::make_unique<sdbusplus::server::manager::manager>(
+                bus, NVME_MANAGER_PATH);
+
+        for (const auto& config : configs)
+        {
+            drives[config.index].inventory = std::make_unique<NvmeInventory>(
+                bus, NVME_LOCAL_INVENTORY_PATH + config.index,
+                config.inventoryPath);
+        }
+        return;
+    }
+
+    auto inventoryManager = util::SDBusPlus::target(
+        INVENTORY_BUSNAME, INVENTORY_NAMESPACE, INVENTORY_MANAGER_IFACE);
+
+    notifyCalls.begin();
     for (const auto config : configs)
     {
         inventoryPath = "/system/chassis/motherboard/nvme" + config.index;
@@ -456,122 +1012,601 @@ void Nvme::createNVMeInventory()
             inventoryPath,
             {{ITEM_IFACE, {}}, {NVME_STATUS_IFACE, {}}, {ASSET_IFACE, {}}},
         }};
-        util::SDBusPlus::CallMethod(bus, INVENTORY_BUSNAME, INVENTORY_NAMESPACE,
-                                    INVENTORY_MANAGER_IFACE, "Notify", obj);
+        notifyCalls.callMethod(bus, inventoryManager, "Notify", obj);
+    }
+}
+
+void Nvme::updateSnapshot(const phosphor::nvme::Nvme::NVMeConfig& config,
+                          bool present,
+                          const phosphor::nvme::Nvme::NVMeData& nvmeData)
+{
+    // Fill the reused record, an unchanged drive then neither allocates
+    // nor dirties the snapshot.
+    auto& record = snapshotRecord;
+
+    record.index = config.index;
+    record.present = present;
+    record.vendor = nvmeData.vendor;
+    record.serialNumber = nvmeData.serialNumber;
+    record.smartWarnings = nvmeData.smartWarnings;
+    record.statusFlags = nvmeData.statusFlags;
+    record.driveLifeUsed = nvmeData.driveLifeUsed;
+    record.sensorValue = present ? nvmeData.sensorValue
+                                 : (int8_t)TEMPERATURE_SENSOR_FAILURE;
+    auto led = leds.find(config.index);
+    record.faultLed = (led != leds.end()) && led->second->fault();
+    record.locateLed = (led != leds.end()) && led->second->locate();
+
+    snapshot.update(record);
+}
+
+void Nvme::restoreSnapshot()
+{
+    for (const auto& record : snapshot.load())
+    {
+        auto config = std::find_if(
+            configs.begin(), configs.end(),
+            [&record](const auto& c) { return c.index == record.index; });
+
+        if (config == configs.end())
+        {
+            continue;
+        }
+
+        // The LED manager kept the LED states while this daemon was down.
+        leds[config->index]->restore(record.faultLed, record.locateLed);
+
+        if (!record.present)
+        {
+            continue;
+        }
+
+        NVMeData nvmeData;
+        nvmeData.present = true;
+        nvmeData.vendor = record.vendor;
+        nvmeData.serialNumber = record.serialNumber;
+        nvmeData.smartWarnings = record.smartWarnings;
+        nvmeData.statusFlags = record.statusFlags;
+        nvmeData.driveLifeUsed = record.driveLifeUsed;
+        nvmeData.sensorValue = record.sensorValue;
+
+        // Publish the last known state right away, marked unavailable
+        // until the first poll cycle has revalidated it.
+        drives[config->index].removed = false;
+        createSensor(*config, nvmeData, false);
+        publishInventory(*config, true, nvmeData);
+
+        updateSnapshot(*config, true, nvmeData);
+    }
+
+    announceSensors();
+}
+
+std::shared_ptr<phosphor::nvme::NvmeSSD>
+    Nvme::createSensor(const phosphor::nvme::Nvme::NVMeConfig& config,
+                       const phosphor::nvme::Nvme::NVMeData& nvmeData,
+                       bool available)
+{
+    auto nvmeSSD = std::make_shared<phosphor::nvme::NvmeSSD>(
+        bus, config.objPath.c_str());
+
+    nvmeSSD->initSensor(nvmeData.sensorValue, config.criticalHigh,
+                        config.criticalLow, config.maxValue, config.minValue,
+                        config.warningHigh, config.warningLow, available);
+
+    nvmes.emplace(config.index, nvmeSSD);
+    healths[config.index] = std::make_unique<NvmeHealth>(
+        bus, _event, *buses.at(config.busID), config.objPath, config.busID,
+        config.address, config.healthCommandCodes, config.healthCacheTTL);
+    pendingSensors.push_back(nvmeSSD);
+
+    return nvmeSSD;
+}
+
+void Nvme::announceSensors()
+{
+    for (const auto& nvmeSSD : pendingSensors)
+    {
+        nvmeSSD->emit_object_added();
+    }
+
+    pendingSensors.clear();
+}
+
+void Nvme::createLEDs()
+{
+    for (const auto& config : configs)
+    {
+        leds[config.index] = std::make_unique<NvmeLed>(
+            bus, config.faultLedGroupPath, config.locateLedGroupPath,
+            config.locateLedControllerBusName, config.locateLedControllerPath);
+    }
+
+    // Command the LED states again when the LED manager or a locate LED
+    // controller restarts.
+    std::set<std::string> owners = {LED_GROUP_BUSNAME};
+    for (const auto& config : configs)
+    {
+        if (!config.locateLedControllerBusName.empty())
+        {
+            owners.insert(config.locateLedControllerBusName);
+        }
+    }
+
+    for (const auto& owner : owners)
+    {
+        ledOwnerMatches.push_back(std::make_unique<
+                                  sdbusplus::bus::match::match>(
+            bus, sdbusplus::bus::match::rules::nameOwnerChanged(owner),
+            [this, owner](sdbusplus::message::message& msg) {
+                std::string name, oldOwner, newOwner;
+                msg.read(name, oldOwner, newOwner);
+
+                if (newOwner.empty())
+                {
+                    return;
+                }
+
+                for (const auto& config : configs)
+                {
+                    if (owner == LED_GROUP_BUSNAME ||
+                        owner == config.locateLedControllerBusName)
+                    {
+                        leds[config.index]->invalidate();
+                    }
+                }
+            }));
+    }
+}
+
+void Nvme::createThermals()
+{
+    std::vector<std::string> all;
+
+    for (const auto& config : configs)
+    {
+        all.push_back(config.index);
+    }
+
+    thermals.push_back(
+        std::make_unique<NvmeThermal>(bus, NVME_OBJ_PATH, all));
+
+    for (const auto& zone : thermalZones)
+    {
+        thermals.push_back(std::make_unique<NvmeThermal>(
+            bus, NVME_OBJ_PATH "_" + zone.name, zone.drives));
+    }
+
+    for (const auto& thermal : thermals)
+    {
+        thermal->announce();
+    }
+}
+
+void Nvme::updateThermals(const phosphor::nvme::Nvme::NVMeConfig& config,
+                          bool success,
+                          const phosphor::nvme::Nvme::NVMeData& nvmeData)
+{
+    // A drive that can not be read, or reports a sensor failure (0x81),
+    // has no temperature.
+    std::optional<int8_t> value;
+    if (success && nvmeData.sensorValue != (int8_t)TEMPERATURE_SENSOR_FAILURE)
+    {
+        value = nvmeData.sensorValue;
+    }
+
+    for (const auto& thermal : thermals)
+    {
+        thermal->update(config.index, value);
+    }
+}
+
+void Nvme::createBuses()
+{
+    for (const auto& config : configs)
+    {
+        if (buses.find(config.busID) == buses.end())
+        {
+            buses.emplace(config.busID,
+                          std::make_unique<NvmeBus>(
+                              _event, config.busID,
+                              getBusSettings(config.busID)));
+        }
     }
 }
 
 void Nvme::init()
 {
+    createBuses();
+
+    for (const auto& config : configs)
+    {
+        auto& drive = drives[config.index];
+
+        drive.poll.address = config.address;
+        drive.poll.setCommandCodes(config.layout->commandCodes,
+                                   config.layout->blockLengths);
+        drive.poll.done = [this, &config](NvmeBus::Transaction&) {
+            pollDone(config);
+        };
+        drive.gpioRetry = std::make_unique<
+            sdeventplus::utility::Timer<sdeventplus::ClockId::Monotonic>>(
+            _event, [this, &config](auto&) { sampleDrive(config); });
+        drive.itemTarget = util::SDBusPlus::target(
+            INVENTORY_BUSNAME, config.inventoryPath, ITEM_IFACE);
+        drive.assetTarget = util::SDBusPlus::target(
+            INVENTORY_BUSNAME, config.inventoryPath, ASSET_IFACE);
+        drive.statusTarget = util::SDBusPlus::target(
+            INVENTORY_BUSNAME, config.inventoryPath, NVME_STATUS_IFACE);
+        drive.inventoryCalls.onDone([&drive](bool failed) {
+            if (failed)
+            {
+                drive.inventoryValid = false;
+            }
+        });
+    }
+
     createNVMeInventory();
+    createLEDs();
+    createThermals();
+    createManagerInterface();
+
+    // A replay must start from the state in the trace only.
+    if (phosphor::smbus::I2cTrace::get().mode() !=
+        phosphor::smbus::I2cTrace::Mode::Replay)
+    {
+        restoreSnapshot();
+        createPowerMatch();
+    }
 }
 
 /** @brief Monitor NVMe drives every one second  */
 void Nvme::read()
 {
-    std::string devPresentPath;
-    std::string devPwrGoodPath;
-    std::string inventoryPath;
+    auto now = std::chrono::steady_clock::now();
 
-    static std::unordered_map<std::string, bool> isErrorPower;
+    if (!polling.staggered)
+    {
+        beginCycle(now);
 
-    for (auto config : configs)
+        for (const auto& config : configs)
+        {
+            readDrive(config);
+        }
+
+        cycleEnding = true;
+        checkCycle();
+        return;
+    }
+
+    // Staggered: each drive has its own phase within the interval, and
+    // every wakeup reads only the drives whose phase has come.
+    if (nextDrive == 0)
     {
-        NVMeData nvmeData;
-        devPresentPath =
-            GPIO_BASE_PATH + std::to_string(config.presentPin) + "/value";
+        beginCycle(now);
+    }
+
+    auto due = nextDrive + 1;
+    if (polling.catchUp == PollingConfig::CatchUp::Burst)
+    {
+        // Read every drive whose phase has passed, so that a late cycle
+        // gets back on schedule.
+        auto slot = pollInterval / std::max<size_t>(configs.size(), 1);
+        size_t passed = (now - cycleStart) / slot + 1;
+        due = std::max(due, std::min(passed, configs.size()));
+    }
+
+    while (nextDrive < due && nextDrive < configs.size())
+    {
+        readDrive(configs[nextDrive++]);
+    }
+
+    if (nextDrive >= configs.size())
+    {
+        nextDrive = 0;
+        cycleEnding = true;
+        checkCycle();
+    }
+}
+
+void Nvme::beginCycle(std::chrono::steady_clock::time_point now)
+{
+    // A read of the previous cycle is still in progress, publish the
+    // results of the cycle without it.
+    if (cycleEnding)
+    {
+        cycleEnding = false;
+        finishCycle(cycleStart);
+    }
 
-        devPwrGoodPath =
-            GPIO_BASE_PATH + std::to_string(config.pwrGoodPin) + "/value";
+    cycleStart = now;
+}
 
-        inventoryPath = NVME_INVENTORY_PATH + config.index;
+void Nvme::checkCycle()
+{
+    if (cycleEnding && outstanding == 0)
+    {
+        cycleEnding = false;
+        finishCycle(cycleStart);
+    }
+}
 
-        auto iter = nvmes.find(config.index);
+void Nvme::readDrive(const phosphor::nvme::Nvme::NVMeConfig& config)
+{
+    auto& drive = drives[config.index];
 
-        if (getGPIOValueOfNvme(devPresentPath) == IS_PRESENT)
+    // The drive is still being read, e.g. its bus missed a deadline.
+    if (drive.reading)
+    {
+        return;
+    }
+
+    drive.reading = true;
+    drive.gpioRetries = 0;
+    ++outstanding;
+
+    sampleDrive(config);
+}
+
+void Nvme::sampleDrive(const phosphor::nvme::Nvme::NVMeConfig& config)
+{
+    auto& drive = drives[config.index];
+
+    // While the host is off the drives are unpowered, only their presence
+    // is polled.
+    std::string present, powerGood;
+    {
+        NvmeTracer::Span span("gpio", config.index.c_str());
+        present = getGPIOValueOfNvme(config.presentPath);
+        if (present == IS_PRESENT && hostOn)
         {
-            // Drive status is good, update value or create d-bus and update
-            // value.
-            if (getGPIOValueOfNvme(devPwrGoodPath) == POWERGD)
-            {
-                // get NVMe information through i2c by busID.
-                auto success = getNVMeInfobyBusID(config.busID, nvmeData);
-                // can not find. create dbus
-                if (iter == nvmes.end())
-                {
-                    std::cerr << "SSD plug. index = " << config.index
-                              << std::endl;
+            powerGood = getGPIOValueOfNvme(config.pwrGoodPath);
+        }
+    }
 
-                    std::string objPath = NVME_OBJ_PATH + config.index;
-                    auto nvmeSSD = std::make_shared<phosphor::nvme::NvmeSSD>(
-                        bus, objPath.c_str());
-                    nvmes.emplace(config.index, nvmeSSD);
+    // Retry a failed GPIO read from the event loop instead of sleeping.
+    if ((present.empty() ||
+         (present == IS_PRESENT && hostOn && powerGood.empty())) &&
+        drive.gpioRetries < GPIO_READ_RETRIES)
+    {
+        ++drive.gpioRetries;
+        drive.gpioRetry->restartOnce(delay);
+        return;
+    }
 
-                    setNvmeInventoryProperties(true, nvmeData, inventoryPath);
-                    nvmeSSD->setSensorValueToDbus(nvmeData.sensorValue);
-                    nvmeSSD->setSensorThreshold(
-                        config.criticalHigh, config.criticalLow,
-                        config.maxValue, config.minValue, config.warningHigh,
-                        config.warningLow);
+    if (present == IS_PRESENT && powerGood == POWERGD)
+    {
+        // The state is published by pollDone() once the read is done.
+        if (buses.at(config.busID)->submit(drive.poll))
+        {
+            return;
+        }
 
-                    nvmeSSD->checkSensorThreshold();
-                    setLEDsStatus(config, success, nvmeData);
-                }
-                else
-                {
-                    setNvmeInventoryProperties(true, nvmeData, inventoryPath);
-                    iter->second->setSensorValueToDbus(nvmeData.sensorValue);
-                    iter->second->checkSensorThreshold();
-                    setLEDsStatus(config, success, nvmeData);
-                }
+        // The bus is isolated after a missed deadline, or full.
+        clearNVMeData(drive.data);
+        drive.data.sensorValue = (int8_t)TEMPERATURE_SENSOR_FAILURE;
+        publishDrive(config, true, true, false);
+        return;
+    }
 
-                isErrorPower[config.index] = false;
-            }
-            else
-            {
-                // Present pin is true but power good pin is false
-                // remove nvme d-bus path, clean all properties in inventory
-                // and turn on fault LED
+    publishDrive(config, present == IS_PRESENT, false, false);
+}
 
-                setFaultLED(config.locateLedGroupPath, config.faultLedGroupPath,
-                            true);
-                setLocateLED(config.locateLedGroupPath,
-                             config.locateLedControllerBusName,
-                             config.locateLedControllerPath, false);
+void Nvme::pollDone(const phosphor::nvme::Nvme::NVMeConfig& config)
+{
+    auto& drive = drives[config.index];
 
-                nvmeData = NVMeData();
-                setNvmeInventoryProperties(false, nvmeData, inventoryPath);
-                nvmes.erase(config.index);
+    auto success =
+        parseNVMeInfo(config.busID, *config.layout, drive.poll, drive.data,
+                      drive.smbusError);
+    if (success)
+    {
+        drive.sampleTimestamp =
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch())
+                .count();
+    }
 
-                if (isErrorPower[config.index] != true)
-                {
-                    std::cerr << "Present pin is true but power good "
-                                 "pin is false. "
-                                 "index = "
-                              << config.index << std::endl;
-                    std::cerr << "Erase SSD from map and d-bus. index = "
-                              << config.index << std::endl;
-
-                    isErrorPower[config.index] = true;
-                }
-            }
+    publishDrive(config, true, true, success);
+}
+
+void Nvme::publishDrive(const phosphor::nvme::Nvme::NVMeConfig& config,
+                        bool present, bool powerGood, bool success)
+{
+    {
+        NvmeTracer::Span span("publish", config.index.c_str());
+        updateDrive(config, present, powerGood, success);
+
+        // One PropertiesChanged per sensor interface and cycle.
+        auto sensor = nvmes.find(config.index);
+        if (sensor != nvmes.end())
+        {
+            sensor->second->commit();
+        }
+    }
+
+    drives[config.index].reading = false;
+    --outstanding;
+
+    checkCycle();
+}
+
+void Nvme::updateDrive(const phosphor::nvme::Nvme::NVMeConfig& config,
+                       bool present, bool powerGood, bool success)
+{
+    static std::unordered_map<std::string, bool> isErrorPower;
+
+    // The drive is sampled into its own buffers and only what changed is
+    // published, so that polling an unchanged drive does not allocate.
+    auto& drive = drives[config.index];
+    auto& nvmeData = drive.data;
+
+    auto iter = nvmes.find(config.index);
+
+    // Drive status is good, update value or create d-bus and update
+    // value.
+    if (present && powerGood)
+    {
+        if (drive.removed)
+        {
+            logInfo("plug-" + config.index, "SSD plug",
+                    {{"NVME_INDEX", config.index}});
+            drive.removed = false;
+        }
+        drive.absentCycles = 0;
+
+        // can not find. create dbus
+        if (iter == nvmes.end())
+        {
+            createSensor(config, nvmeData, success);
         }
         else
         {
-            // Drive not present, remove nvme d-bus path ,
-            // clean all properties in inventory
-            // and turn off fault and locate LED
+            iter->second->setSensorValueToDbus(nvmeData.sensorValue);
+            iter->second->checkSensorThreshold();
+            // A failed read must not revalidate a restored reading.
+            iter->second->setSensorAvailability(success);
+            iter->second->setSensorFunctional(true);
+        }
 
-            setFaultLED(config.locateLedGroupPath, config.faultLedGroupPath,
-                        false);
-            setLocateLED(config.locateLedGroupPath,
-                         config.locateLedControllerBusName,
-                         config.locateLedControllerPath, false);
+        publishInventory(config, true, nvmeData);
+        setLEDsStatus(config, success, nvmeData);
+        updateSnapshot(config, true, nvmeData);
+        updateThermals(config, success, nvmeData);
 
-            nvmeData = NVMeData();
-            setNvmeInventoryProperties(false, nvmeData, inventoryPath);
-            nvmes.erase(config.index);
+        isErrorPower[config.index] = false;
+        return;
+    }
+
+    if (present && !hostOn)
+    {
+        // The drive is unpowered with the host, keep its last known state
+        // and only mark the reading stale.
+        drive.absentCycles = 0;
+        if (drive.removed)
+        {
+            logInfo("plug-" + config.index, "SSD plug",
+                    {{"NVME_INDEX", config.index}});
+            drive.removed = false;
+
+            clearNVMeData(nvmeData);
+            publishInventory(config, true, nvmeData);
+            updateSnapshot(config, true, nvmeData);
         }
+
+        if (iter != nvmes.end())
+        {
+            iter->second->setSensorAvailability(false);
+            iter->second->setSensorFunctional(true);
+        }
+
+        setLEDs(config, false, false);
+        updateThermals(config, false, nvmeData);
+        return;
+    }
+
+    // Ride out a drive that drops out briefly, only its reading is stale
+    // until the removal is debounced.
+    if (!drive.removed && ++drive.absentCycles < polling.removalDebounce)
+    {
+        if (iter != nvmes.end())
+        {
+            iter->second->setSensorAvailability(false);
+        }
+        updateThermals(config, false, nvmeData);
+        return;
+    }
+    drive.removed = true;
+
+    // The sensor object of the bay is kept for the lifetime of the daemon,
+    // so that a flapping drive does not add and remove it again and again.
+    if (iter != nvmes.end())
+    {
+        iter->second->setSensorAvailability(false);
+        iter->second->setSensorFunctional(!present);
+    }
+
+    clearNVMeData(nvmeData);
+    publishInventory(config, false, nvmeData);
+    updateSnapshot(config, false, nvmeData);
+    updateThermals(config, false, nvmeData);
+
+    if (present)
+    {
+        // Present pin is true but power good pin is false
+        // clean all properties in inventory and turn on fault LED
+        setLEDs(config, true, false);
+
+        if (isErrorPower[config.index] != true)
+        {
+            logError("power-" + config.index,
+                     "Present pin is true but power good pin is "
+                     "false, mark SSD not functional",
+                     {{"NVME_INDEX", config.index}});
+
+            isErrorPower[config.index] = true;
+        }
+    }
+    else
+    {
+        // Drive not present, clean all properties in inventory
+        // and turn off fault and locate LED
+        setLEDs(config, false, false);
+    }
+}
+
+void Nvme::finishCycle(std::chrono::steady_clock::time_point start)
+{
+    // Announce the drives that appeared in this cycle in one pass, after
+    // all of their initial properties are set.
+    announceSensors();
+
+    snapshot.commit();
+
+    auto cycleTime = std::chrono::steady_clock::now() - start;
+
+    auto& tracer = NvmeTracer::get();
+    if (tracer.enabled())
+    {
+        tracer.record("cycle", nullptr, NvmeTracer::loopLane,
+                      std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          start.time_since_epoch())
+                          .count(),
+                      NvmeTracer::now());
+    }
+    if (cycleTime > pollInterval)
+    {
+        ++overruns;
+        logError("poll-overrun", "NVMe poll cycle overrun",
+                 {{"CYCLE_US",
+                   std::to_string(
+                       std::chrono::duration_cast<std::chrono::microseconds>(
+                           cycleTime)
+                           .count())},
+                  {"INTERVAL_US", std::to_string(pollInterval.count())},
+                  {"OVERRUNS", std::to_string(overruns)}});
+    }
+
+    auto& trace = phosphor::smbus::I2cTrace::get();
+    trace.flush();
+    if (trace.mode() != phosphor::smbus::I2cTrace::Mode::Replay)
+    {
+        return;
+    }
+
+    // Recorded accesses that no cycle asks for again, e.g. on-demand
+    // reads, would keep the replay running forever; it ends once a few
+    // cycles in a row found nothing left to replay.
+    auto progress = trace.replayed();
+    replayIdleCycles = (progress == replayed) ? replayIdleCycles + 1 : 0;
+    replayed = progress;
+
+    if (trace.exhausted() || replayIdleCycles >= replayIdleLimit)
+    {
+        logInfo("i2c-trace", "I2C trace replay finished",
+                {{"REPLAYED", std::to_string(progress)},
+                 {"UNMATCHED", std::to_string(trace.unmatched())}});
+        _event.exit(0);
     }
 }
 } // namespace nvme
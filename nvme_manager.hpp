@@ -2,12 +2,22 @@
 
 #include "config.h"
 
+#include "nvme_bus.hpp"
+#include "nvme_health.hpp"
+#include "nvme_inventory.hpp"
+#include "nvme_layout.hpp"
+#include "nvme_led.hpp"
+#include "nvme_snapshot.hpp"
+#include "nvme_thermal.hpp"
 #include "nvmes.hpp"
 #include "sdbusplus.hpp"
 
 #include <fstream>
 #include <sdbusplus/bus.hpp>
+#include <sdbusplus/bus/match.hpp>
 #include <sdbusplus/server.hpp>
+#include <sdbusplus/server/interface.hpp>
+#include <sdbusplus/server/manager.hpp>
 #include <sdbusplus/server/object.hpp>
 #include <sdeventplus/clock.hpp>
 #include <sdeventplus/event.hpp>
@@ -18,6 +28,9 @@ namespace phosphor
 namespace nvme
 {
 
+/** @brief Slack of the poll timer, so that its wakeups can be coalesced */
+static constexpr auto pollTimerAccuracy = std::chrono::milliseconds(50);
+
 /** @class Nvme
  *  @brief Nvme manager implementation.
  */
@@ -32,17 +45,30 @@ class Nvme
 
     /** @brief Constructs Nvme
      *
-     * @param[in] bus     - Handle to system dbus
-     * @param[in] objPath - The dbus path of nvme
+     * @param[in] bus          - Handle to system dbus
+     * @param[in] configFile   - JSON configuration file
+     * @param[in] snapshotFile - Warm-restart snapshot file
      */
-    Nvme(sdbusplus::bus::bus& bus) :
-        bus(bus), _event(sdeventplus::Event::get_default()),
-        _timer(_event, std::bind(&Nvme::read, this))
+    Nvme(sdbusplus::bus::bus& bus,
+         const std::string& configFile = NVME_CONFIG_FILE,
+         const std::string& snapshotFile = NVME_SNAPSHOT_PATH) :
+        bus(bus),
+        configFile(configFile), _event(sdeventplus::Event::get_default()),
+        _timer(_event, std::bind(&Nvme::read, this), std::nullopt,
+               pollTimerAccuracy),
+        snapshot(snapshotFile)
     {
         // read json file
         configs = getNvmeConfig();
+        polling = getPollingConfig();
+        thermalZones = getThermalZones();
+        inventoryMode = getInventoryMode();
     }
 
+    ~Nvme();
+
+    struct Layout;
+
     /**
      * Structure for keeping nvme configure data required by nvme monitoring
      */
@@ -50,6 +76,7 @@ class Nvme
     {
         std::string index;
         uint8_t busID;
+        uint8_t address; /* I2C slave address of the NVMe-MI endpoint  */
         std::string faultLedGroupPath;
         uint8_t presentPin;
         uint8_t pwrGoodPin;
@@ -62,6 +89,13 @@ class Nvme
         int8_t minValue;
         int8_t warningHigh;
         int8_t warningLow;
+        std::chrono::seconds healthCacheTTL;
+        std::vector<uint8_t> healthCommandCodes;
+        std::string presentPath;   /* Present GPIO value file  */
+        std::string pwrGoodPath;   /* Power good GPIO value file  */
+        std::string inventoryPath; /* Inventory object path  */
+        std::string objPath;       /* Sensor object path  */
+        const Layout* layout;      /* Response layout of the drive  */
     };
 
     /**
@@ -81,14 +115,109 @@ class Nvme
                                   129(0x81) accroding to NVMe-MI SPEC*/
     };
 
+    /**
+     * Structure for keeping a response layout selectable in the
+     * configuration, see nvme_layout.hpp
+     */
+    struct Layout
+    {
+        const char* name;                  /* Name in the configuration  */
+        std::vector<uint8_t> commandCodes; /* Command codes of a poll  */
+        std::vector<uint8_t> blockLengths; /* Block lengths by command  */
+        FaultMasks faults;                 /* SMART warning fault bits  */
+        /* Decoder specialised for the layout */
+        void (*decode)(const NvmeBus::Transaction& poll, NVMeData& nvmeData);
+    };
+
+    /**
+     * Structure for keeping the state of a drive across poll cycles
+     */
+    struct NVMeDrive
+    {
+        NVMeData data;      /* Buffers the drive is sampled into  */
+        NVMeData published; /* Inventory properties last set on D-Bus  */
+        bool inventoryValid = false; /* Whether published is on D-Bus  */
+        bool removed = true;         /* Whether the drive is declared gone  */
+        uint32_t absentCycles = 0;   /* Consecutive cycles it was not ready  */
+        bool reading = false;        /* Whether a read is in progress  */
+        NvmeBus::Transaction poll;   /* Command code 0 and 8 block reads  */
+        uint32_t gpioRetries = 0;    /* GPIO read retries of this read  */
+        bool smbusError = false;     /* Whether a read failure is logged  */
+        uint64_t sampleTimestamp = 0; /* Wall clock time of the last
+                                         successful read in microseconds  */
+        /* Inventory object hosted by this service in local mode  */
+        std::unique_ptr<NvmeInventory> inventory;
+        /* Inventory Manager interfaces of the drive in remote mode  */
+        util::SDBusPlus::Target itemTarget;
+        util::SDBusPlus::Target assetTarget;
+        util::SDBusPlus::Target statusTarget;
+        util::AsyncCalls inventoryCalls; /* Pending Sets of the targets  */
+        /* Schedules a GPIO read retry on the event loop */
+        std::unique_ptr<
+            sdeventplus::utility::Timer<sdeventplus::ClockId::Monotonic>>
+            gpioRetry;
+    };
+
+    /**
+     * Structure for keeping the polling configuration
+     */
+    struct PollingConfig
+    {
+        /** @brief How a late staggered cycle gets back on schedule */
+        enum class CatchUp
+        {
+            Slip,  /* Read one drive per wakeup, the cycle stretches  */
+            Burst, /* Read every drive whose phase has passed at once  */
+        };
+
+        std::chrono::milliseconds interval; /* Poll cycle period  */
+        bool staggered; /* Spread the drive reads across the period  */
+        CatchUp catchUp;
+        uint32_t removalDebounce; /* Cycles a drive must be gone before it
+                                     is declared removed  */
+        std::chrono::milliseconds powerOffInterval; /* Poll cycle period
+                                     while the host is off, 0 disables
+                                     presence-only polling  */
+    };
+
+    /** @brief Where the inventory interfaces of the drives are hosted */
+    enum class InventoryMode
+    {
+        Remote, /* Set on the Inventory Manager  */
+        Local,  /* Hosted by this service  */
+    };
+
+    /**
+     * Structure for keeping a thermal zone of drives
+     */
+    struct ThermalZone
+    {
+        std::string name;                /* Zone name  */
+        std::vector<std::string> drives; /* Indexes of the zone drives  */
+    };
+
     /** @brief Setup polling timer in a sd event loop and attach to D-Bus
      *         event loop.
      */
     void run();
 
-    /** @brief Get GPIO value of nvme by sysfs */
+    /** @brief D-Bus handler of GetDrives */
+    static int getDrives(sd_bus_message* msg, void* context,
+                         sd_bus_error* error);
+
+    /** @brief D-Bus handler of SetTracing */
+    static int setTracing(sd_bus_message* msg, void* context,
+                          sd_bus_error* error);
+
+    /** @brief D-Bus handler of DumpTrace */
+    static int dumpTrace(sd_bus_message* msg, void* context,
+                         sd_bus_error* error);
+
+    /** @brief Get GPIO value of nvme by sysfs, empty if it can not be
+     *         read
+     */
     std::string getGPIOValueOfNvme(const std::string& fullPath);
-    /** @brief Map of the object NvmeSSD */
+    /** @brief Map of the object NvmeSSD, kept once a drive was seen */
     std::unordered_map<std::string, std::shared_ptr<phosphor::nvme::NvmeSSD>>
         nvmes;
 
@@ -102,26 +231,94 @@ class Nvme
                        bool success,
                        const phosphor::nvme::Nvme::NVMeData& nvmeData);
 
-    /** @brief Set SSD fault LED status */
-    void setFaultLED(const std::string& locateLedGroupPath,
-                     const std::string& ledPath, const bool& request);
-    /** @brief Set SSD locate LED status */
-    void setLocateLED(const std::string& ledPath,
-                      const std::string& locateLedBusName,
-                      const std::string& locateLedPath, const bool& ispresent);
-    /** @brief Get Identify State*/
-    bool getLEDGroupState(const std::string& ledPath);
-
-    /** @brief Set inventory properties of nvme */
-    void setNvmeInventoryProperties(
-        const bool& present, const phosphor::nvme::Nvme::NVMeData& nvmeData,
-        const std::string& inventoryPath);
+    /** @brief Request fault and locate LED status of SSD
+     *
+     * @param[in] config - Nvme configure data
+     * @param[in] fault - Whether the fault LED is asserted
+     * @param[in] locate - Whether the locate LED is on
+     */
+    void setLEDs(const phosphor::nvme::Nvme::NVMeConfig& config, bool fault,
+                 bool locate);
+
+    /** @brief Create the LED state machine of every drive bay */
+    void createLEDs();
+
+    /** @brief Set inventory properties of nvme
+     *
+     * @return Whether every property was set, in remote mode sent; a
+     *         failed reply clears inventoryValid of the drive later
+     */
+    bool setNvmeInventoryProperties(
+        const phosphor::nvme::Nvme::NVMeConfig& config, const bool& present,
+        const phosphor::nvme::Nvme::NVMeData& nvmeData);
 
+    /** @brief Set inventory properties of nvme if they differ from the
+     *         ones last set
+     *
+     * @param[in] config - Nvme configure data
+     * @param[in] present - Whether or not the drive is present
+     * @param[in] nvmeData - Nvme information
+     */
+    void publishInventory(const phosphor::nvme::Nvme::NVMeConfig& config,
+                          bool present,
+                          const phosphor::nvme::Nvme::NVMeData& nvmeData);
+
+    /** @brief Create the inventory objects of every drive bay, on the
+     *         Inventory Manager or locally depending on the inventory mode
+     */
     void createNVMeInventory();
 
+    /** @brief Create the sensor object of a drive with its initial
+     *         properties, deferring its announcement to announceSensors()
+     *
+     * @param[in] config - Nvme configure data
+     * @param[in] nvmeData - Nvme information
+     * @param[in] available - Whether the sensor value is a fresh reading
+     */
+    std::shared_ptr<phosphor::nvme::NvmeSSD>
+        createSensor(const phosphor::nvme::Nvme::NVMeConfig& config,
+                     const phosphor::nvme::Nvme::NVMeData& nvmeData,
+                     bool available);
+
+    /** @brief Emit InterfacesAdded for every sensor created since the
+     *         last call
+     */
+    void announceSensors();
+
+    /** @brief Create the aggregate temperature sensors of all drives and
+     *         of every thermal zone
+     */
+    void createThermals();
+
+    /** @brief Feed the reading of a drive into the aggregate temperature
+     *         sensors
+     *
+     * @param[in] config - Nvme configure data
+     * @param[in] success - Success or not that get NVMe Info by SMbus
+     * @param[in] nvmeData - Nvme information
+     */
+    void updateThermals(const phosphor::nvme::Nvme::NVMeConfig& config,
+                        bool success,
+                        const phosphor::nvme::Nvme::NVMeData& nvmeData);
+
+    /** @brief Republish the drive state persisted by a previous instance */
+    void restoreSnapshot();
+
+    /** @brief Record the state published for a drive in this cycle
+     *
+     * @param[in] config - Nvme configure data
+     * @param[in] present - Whether or not the drive is present
+     * @param[in] nvmeData - Nvme information
+     */
+    void updateSnapshot(const phosphor::nvme::Nvme::NVMeConfig& config,
+                        bool present,
+                        const phosphor::nvme::Nvme::NVMeData& nvmeData);
+
   private:
     /** @brief sdbusplus bus client connection. */
     sdbusplus::bus::bus& bus;
+    /** @brief JSON configuration file */
+    std::string configFile;
     /** @brief the Event Loop structure */
     sdeventplus::Event _event;
     /** @brief Read Timer */
@@ -129,12 +326,123 @@ class Nvme
 
     std::vector<phosphor::nvme::Nvme::NVMeConfig> configs;
 
+    /** @brief Warm-restart snapshot of the published drive state */
+    NvmeSnapshot snapshot;
+    /** @brief Poll state of the drives by index */
+    std::unordered_map<std::string, NVMeDrive> drives;
+    /** @brief Record reused by updateSnapshot() */
+    NvmeSnapshot::Record snapshotRecord;
+    /** @brief Open GPIO value files by path */
+    std::unordered_map<std::string, int> gpioFds;
+    /** @brief Extended health data of the drives by index */
+    std::unordered_map<std::string, std::unique_ptr<NvmeHealth>> healths;
+    /** @brief Sensors created but not yet announced on D-Bus */
+    std::vector<std::shared_ptr<phosphor::nvme::NvmeSSD>> pendingSensors;
+    /** @brief LED state machines of the drive bays by index */
+    std::unordered_map<std::string, std::unique_ptr<NvmeLed>> leds;
+    /** @brief Matches of LED manager and locate LED controller restarts */
+    std::vector<std::unique_ptr<sdbusplus::bus::match::match>> ledOwnerMatches;
+    /** @brief Where the inventory interfaces are hosted */
+    InventoryMode inventoryMode = InventoryMode::Remote;
+    /** @brief Pending Notify calls of the Inventory Manager */
+    util::AsyncCalls notifyCalls;
+    /** @brief Object manager of the local inventory objects */
+    std::unique_ptr<sdbusplus::server::manager::manager> inventoryObjManager;
+    /** @brief Handle of the manager D-Bus interface */
+    std::unique_ptr<sdbusplus::server::interface::interface> managerIface;
+    /** @brief Match of chassis power state changes */
+    std::unique_ptr<sdbusplus::bus::match::match> powerMatch;
+    /** @brief Whether the host is powered, only the presence of the
+     *         drives is polled while it is not
+     */
+    bool hostOn = true;
+
+    /** @brief Thermal zones of drives */
+    std::vector<ThermalZone> thermalZones;
+    /** @brief Aggregate temperature sensors */
+    std::vector<std::unique_ptr<NvmeThermal>> thermals;
+
+    /** @brief Polling configuration */
+    PollingConfig polling;
+    /** @brief Poll cycle period */
+    std::chrono::microseconds pollInterval;
+    /** @brief Number of drives whose read is in progress */
+    size_t outstanding = 0;
+    /** @brief Whether every drive of the cycle was started and the cycle
+     *         ends once their reads are done
+     */
+    bool cycleEnding = false;
+    /** @brief Position of the next drive to read in a staggered cycle */
+    size_t nextDrive = 0;
+    /** @brief Start of the current staggered cycle */
+    std::chrono::steady_clock::time_point cycleStart;
+    /** @brief Number of poll cycles that took longer than the period */
+    uint64_t overruns = 0;
+    /** @brief Replayed accesses at the end of the last poll cycle */
+    size_t replayed = 0;
+    /** @brief Consecutive poll cycles that replayed no access */
+    uint32_t replayIdleCycles = 0;
+
     /** @brief Set up initial configuration value of NVMe */
     void init();
     /** @brief Monitor NVMe drives every one second  */
     void read();
+    /** @brief Start reading one drive, its state is published once the
+     *         read is done
+     */
+    void readDrive(const phosphor::nvme::Nvme::NVMeConfig& config);
+    /** @brief Read the GPIOs of a drive and queue its SMBus read */
+    void sampleDrive(const phosphor::nvme::Nvme::NVMeConfig& config);
+    /** @brief Handle the completed SMBus read of a drive */
+    void pollDone(const phosphor::nvme::Nvme::NVMeConfig& config);
+    /** @brief Publish the state of a drive and end its read
+     *
+     * @param[in] config - Nvme configure data
+     * @param[in] present - Whether the present pin is asserted
+     * @param[in] powerGood - Whether the power good pin is asserted
+     * @param[in] success - Success or not that get NVMe Info by SMbus
+     */
+    void publishDrive(const phosphor::nvme::Nvme::NVMeConfig& config,
+                      bool present, bool powerGood, bool success);
+    /** @brief Publish the state of a drive */
+    void updateDrive(const phosphor::nvme::Nvme::NVMeConfig& config,
+                     bool present, bool powerGood, bool success);
+    /** @brief Start a poll cycle
+     *
+     * @param[in] now - When the cycle starts
+     */
+    void beginCycle(std::chrono::steady_clock::time_point now);
+    /** @brief Finish the cycle once every started read is done */
+    void checkCycle();
+    /** @brief Create the I2C bus workers */
+    void createBuses();
+    /** @brief Provide the manager D-Bus interface */
+    void createManagerInterface();
+    /** @brief Follow the chassis power state */
+    void createPowerMatch();
+    /** @brief Switch the polling mode for a chassis power state
+     *
+     * @param[in] state - CurrentPowerState of the chassis
+     */
+    void setPowerState(const std::string& state);
+    /** @brief Start the poll timer with the period of the polling mode */
+    void restartTimer();
+    /** @brief Publish the results of a complete poll cycle
+     *
+     * @param[in] start - When the cycle started
+     */
+    void finishCycle(std::chrono::steady_clock::time_point start);
 
     std::vector<phosphor::nvme::Nvme::NVMeConfig> getNvmeConfig();
+    PollingConfig getPollingConfig();
+    std::vector<ThermalZone> getThermalZones();
+    InventoryMode getInventoryMode();
+    NvmeBus::Settings getBusSettings(uint8_t busID);
+
+    /** @brief I2C bus workers by bus ID, stopped before the transactions
+     *         they run are destroyed
+     */
+    std::unordered_map<uint8_t, std::unique_ptr<NvmeBus>> buses;
 };
 } // namespace nvme
 } // namespace phosphor
\ No newline at end of file
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace phosphor
+{
+namespace nvme
+{
+
+/** @class NvmeRing
+ *  @brief Bounded lock-free queue between one producer and one consumer
+ *         thread.
+ *
+ *  push() is only called by the producer and pop() only by the consumer.
+ *  Neither blocks; push() fails when the queue is full.
+ */
+template <typename T, size_t Capacity>
+class NvmeRing
+{
+    static_assert(Capacity && !(Capacity & (Capacity - 1)),
+                  "Capacity must be a power of two");
+
+  public:
+    /** @brief Append an item, false if the queue is full */
+    bool push(const T& item)
+    {
+        auto tail = this->tail.load(std::memory_order_relaxed);
+        if (tail - head.load(std::memory_order_acquire) == Capacity)
+        {
+            return false;
+        }
+
+        slots[tail & (Capacity - 1)] = item;
+        this->tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** @brief Remove the oldest item, false if the queue is empty */
+    bool pop(T& item)
+    {
+        auto head = this->head.load(std::memory_order_relaxed);
+        if (head == tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        item = slots[head & (Capacity - 1)];
+        this->head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+  private:
+    std::array<T, Capacity> slots;
+    /** @brief Position of the oldest item, written by the consumer */
+    alignas(64) std::atomic<size_t> head{0};
+    /** @brief Position past the newest item, written by the producer */
+    alignas(64) std::atomic<size_t> tail{0};
+};
+
+} // namespace nvme
+} // namespace phosphor
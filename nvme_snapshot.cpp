@@ -0,0 +1,211 @@
+#include "nvme_snapshot.hpp"
+
+#include "nvme_log.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+namespace phosphor
+{
+namespace nvme
+{
+
+namespace fs = std::filesystem;
+
+static constexpr const char snapshotMagic[4] = {'N', 'V', 'M', 'S'};
+static constexpr uint8_t snapshotVersion = 1;
+
+static constexpr uint8_t presentFlag = 1;
+static constexpr uint8_t faultLedFlag = 1 << 1;
+static constexpr uint8_t locateLedFlag = 1 << 2;
+
+bool NvmeSnapshot::Record::operator==(const Record& other) const
+{
+    return index == other.index && present == other.present &&
+           vendor == other.vendor && serialNumber == other.serialNumber &&
+           smartWarnings == other.smartWarnings &&
+           statusFlags == other.statusFlags &&
+           driveLifeUsed == other.driveLifeUsed &&
+           sensorValue == other.sensorValue && faultLed == other.faultLed &&
+           locateLed == other.locateLed;
+}
+
+/** @brief Append a length prefixed string to the snapshot buffer */
+static void putString(std::string& buf, const std::string& value)
+{
+    auto len = std::min<size_t>(value.size(), UINT8_MAX);
+    buf.push_back(static_cast<char>(len));
+    buf.append(value, 0, len);
+}
+
+/** @brief Read a length prefixed string from the snapshot buffer */
+static bool getString(const std::string& buf, size_t& offset,
+                      std::string& value)
+{
+    if (offset >= buf.size())
+    {
+        return false;
+    }
+
+    size_t len = static_cast<uint8_t>(buf[offset++]);
+    if (offset + len > buf.size())
+    {
+        return false;
+    }
+
+    value.assign(buf, offset, len);
+    offset += len;
+
+    return true;
+}
+
+std::vector<NvmeSnapshot::Record> NvmeSnapshot::load()
+{
+    std::vector<Record> result;
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        return result;
+    }
+
+    std::string buf((std::istreambuf_iterator<char>(file)),
+                    std::istreambuf_iterator<char>());
+
+    size_t offset = sizeof(snapshotMagic) + 1;
+    if (buf.size() < offset ||
+        buf.compare(0, sizeof(snapshotMagic), snapshotMagic,
+                    sizeof(snapshotMagic)) != 0 ||
+        static_cast<uint8_t>(buf[sizeof(snapshotMagic)]) != snapshotVersion)
+    {
+        logError("snapshot", "Ignore unknown NVMe snapshot format",
+                 {{"SNAPSHOT_PATH", path}});
+        return result;
+    }
+
+    while (offset < buf.size())
+    {
+        Record record;
+
+        if (!getString(buf, offset, record.index) ||
+            offset + 2 > buf.size())
+        {
+            break;
+        }
+
+        auto flags = static_cast<uint8_t>(buf[offset++]);
+        record.present = flags & presentFlag;
+        record.faultLed = flags & faultLedFlag;
+        record.locateLed = flags & locateLedFlag;
+        record.sensorValue = static_cast<int8_t>(buf[offset++]);
+
+        if (!getString(buf, offset, record.vendor) ||
+            !getString(buf, offset, record.serialNumber) ||
+            !getString(buf, offset, record.smartWarnings) ||
+            !getString(buf, offset, record.statusFlags) ||
+            !getString(buf, offset, record.driveLifeUsed))
+        {
+            break;
+        }
+
+        result.push_back(record);
+        records[record.index] = record;
+    }
+
+    if (offset != buf.size())
+    {
+        logError("snapshot", "NVMe snapshot is truncated",
+                 {{"SNAPSHOT_PATH", path}});
+        records.clear();
+        result.clear();
+    }
+
+    return result;
+}
+
+void NvmeSnapshot::update(const Record& record)
+{
+    auto iter = records.find(record.index);
+
+    if (iter == records.end())
+    {
+        records.emplace(record.index, record);
+        dirty = true;
+    }
+    else if (iter->second != record)
+    {
+        iter->second = record;
+        dirty = true;
+    }
+}
+
+void NvmeSnapshot::commit()
+{
+    static bool isErrorSnapshot = false;
+
+    if (!dirty)
+    {
+        return;
+    }
+
+    std::string buf(snapshotMagic, sizeof(snapshotMagic));
+    buf.push_back(static_cast<char>(snapshotVersion));
+
+    for (const auto& [index, record] : records)
+    {
+        putString(buf, record.index);
+        buf.push_back(static_cast<char>(
+            (record.present ? presentFlag : 0) |
+            (record.faultLed ? faultLedFlag : 0) |
+            (record.locateLed ? locateLedFlag : 0)));
+        buf.push_back(static_cast<char>(record.sensorValue));
+        putString(buf, record.vendor);
+        putString(buf, record.serialNumber);
+        putString(buf, record.smartWarnings);
+        putString(buf, record.statusFlags);
+        putString(buf, record.driveLifeUsed);
+    }
+
+    // Write to a temporary file and rename it, so that a crash while
+    // writing never leaves a partial snapshot behind.
+    std::error_code ec;
+    fs::create_directories(fs::path(path).parent_path(), ec);
+
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        file.write(buf.data(), buf.size());
+        file.close();
+
+        if (!file)
+        {
+            if (!isErrorSnapshot)
+            {
+                logError("snapshot", "Write NVMe snapshot fail",
+                         {{"SNAPSHOT_PATH", tmpPath}});
+                isErrorSnapshot = true;
+            }
+            return;
+        }
+    }
+
+    fs::rename(tmpPath, path, ec);
+    if (ec)
+    {
+        if (!isErrorSnapshot)
+        {
+            logError("snapshot", "Rename NVMe snapshot fail",
+                     {{"SNAPSHOT_PATH", path}, {"ERROR", ec.message()}});
+            isErrorSnapshot = true;
+        }
+        return;
+    }
+
+    isErrorSnapshot = false;
+    dirty = false;
+}
+
+} // namespace nvme
+} // namespace phosphor
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace phosphor
+{
+namespace nvme
+{
+
+/** @class NvmeSnapshot
+ *  @brief Persists the last published state of every drive so that a
+ *         restarted daemon can republish it before the first poll cycle.
+ */
+class NvmeSnapshot
+{
+  public:
+    NvmeSnapshot() = delete;
+    NvmeSnapshot(const NvmeSnapshot&) = delete;
+    NvmeSnapshot& operator=(const NvmeSnapshot&) = delete;
+    NvmeSnapshot(NvmeSnapshot&&) = delete;
+    NvmeSnapshot& operator=(NvmeSnapshot&&) = delete;
+
+    /** @brief Constructs NvmeSnapshot
+     *
+     * @param[in] path - File the snapshot is persisted to
+     */
+    explicit NvmeSnapshot(const std::string& path) : path(path)
+    {
+    }
+
+    /**
+     * Structure for keeping the state of one drive
+     */
+    struct Record
+    {
+        std::string index;         /* NVMe drive index  */
+        bool present;              /* Whether or not the nvme is present  */
+        std::string vendor;        /* The nvme manufacturer  */
+        std::string serialNumber;  /* The nvme serial number  */
+        std::string smartWarnings; /* Indicates smart warnings for the state  */
+        std::string statusFlags;   /* Indicates the status of the drives  */
+        std::string driveLifeUsed; /* Estimate of the percentage life used  */
+        int8_t sensorValue;        /* Last temperature reading  */
+        bool faultLed;             /* Last commanded fault LED state  */
+        bool locateLed;            /* Last commanded locate LED state  */
+
+        bool operator==(const Record& other) const;
+        bool operator!=(const Record& other) const
+        {
+            return !(*this == other);
+        }
+    };
+
+    /** @brief Read the records persisted by a previous instance
+     *
+     * @return Records of the snapshot, empty if there is none or it is
+     *         not usable
+     */
+    std::vector<Record> load();
+
+    /** @brief Update the in-memory record of a drive
+     *
+     * @param[in] record - Current state of the drive
+     */
+    void update(const Record& record);
+
+    /** @brief Write the records to the snapshot file if any changed */
+    void commit();
+
+  private:
+    /** @brief Snapshot file path */
+    std::string path;
+    /** @brief Records by drive index */
+    std::map<std::string, Record> records;
+    /** @brief Whether records changed since the last commit */
+    bool dirty = false;
+};
+
+} // namespace nvme
+} // namespace phosphor
@@ -0,0 +1,140 @@
+#include "nvme_thermal.hpp"
+
+#include <algorithm>
+#include <sdbusplus/vtable.hpp>
+#include <string_view>
+
+namespace phosphor
+{
+namespace nvme
+{
+
+static const sdbusplus::vtable::vtable_t thermalVtable[] = {
+    sdbusplus::vtable::start(),
+    sdbusplus::vtable::property("HottestDrive", "s", NvmeThermal::getProperty,
+                                sdbusplus::vtable::property_::emits_change),
+    sdbusplus::vtable::property("Drives", "u", NvmeThermal::getProperty,
+                                sdbusplus::vtable::property_::emits_change),
+    sdbusplus::vtable::end()};
+
+NvmeThermal::NvmeThermal(sdbusplus::bus::bus& bus, const std::string& objPath,
+                         const std::vector<std::string>& drives) :
+    maxSensor(std::make_unique<SummaryIfaces>(
+        bus, (objPath + "_max").c_str(), true)),
+    meanSensor(std::make_unique<SummaryIfaces>(
+        bus, (objPath + "_mean").c_str(), true)),
+    summaryIface(bus, (objPath + "_max").c_str(), NVME_THERMAL_IFACE,
+                 thermalVtable, this),
+    drives(drives), temperatures(drives.size())
+{
+    publish(true);
+}
+
+int NvmeThermal::getProperty(sd_bus* bus, const char* path,
+                             const char* interface, const char* property,
+                             sd_bus_message* reply, void* context,
+                             sd_bus_error* error)
+{
+    auto thermal = static_cast<NvmeThermal*>(context);
+
+    if (std::string_view(property) == "Drives")
+    {
+        return sd_bus_message_append(reply, "u", thermal->count);
+    }
+
+    return sd_bus_message_append(
+        reply, "s",
+        thermal->hottest ? thermal->drives[*thermal->hottest].c_str() : "");
+}
+
+void NvmeThermal::update(const std::string& index,
+                         std::optional<int8_t> value)
+{
+    auto drive = std::find(drives.begin(), drives.end(), index);
+    if (drive == drives.end())
+    {
+        return;
+    }
+
+    size_t pos = drive - drives.begin();
+    auto& temperature = temperatures[pos];
+    if (temperature == value)
+    {
+        return;
+    }
+
+    auto oldCount = count;
+    auto oldHottest = hottest;
+    auto oldValue = temperature;
+
+    if (temperature)
+    {
+        sum -= *temperature;
+        --count;
+    }
+    if (value)
+    {
+        sum += *value;
+        ++count;
+    }
+    temperature = value;
+
+    if (hottest == pos)
+    {
+        // Only the hottest drive cooling down or losing its reading needs
+        // a scan of the group.
+        if (!value || *value < *oldValue)
+        {
+            hottest.reset();
+            for (size_t i = 0; i < temperatures.size(); ++i)
+            {
+                if (temperatures[i] &&
+                    (!hottest || *temperatures[i] > *temperatures[*hottest]))
+                {
+                    hottest = i;
+                }
+            }
+        }
+    }
+    else if (value && (!hottest || *value > *temperatures[*hottest]))
+    {
+        hottest = pos;
+    }
+
+    publish(false);
+
+    if (hottest != oldHottest)
+    {
+        summaryIface.property_changed("HottestDrive");
+    }
+    if (count != oldCount)
+    {
+        summaryIface.property_changed("Drives");
+    }
+}
+
+void NvmeThermal::publish(bool skipSignal)
+{
+    if (count == 0)
+    {
+        // Keep the last values, but tell they are stale.
+        maxSensor->AvailabilityInterface::available(false, skipSignal);
+        meanSensor->AvailabilityInterface::available(false, skipSignal);
+        return;
+    }
+
+    maxSensor->ValueIface::value(*temperatures[*hottest], skipSignal);
+    meanSensor->ValueIface::value(static_cast<double>(sum) / count,
+                                  skipSignal);
+    maxSensor->AvailabilityInterface::available(true, skipSignal);
+    meanSensor->AvailabilityInterface::available(true, skipSignal);
+}
+
+void NvmeThermal::announce()
+{
+    maxSensor->emit_object_added();
+    meanSensor->emit_object_added();
+}
+
+} // namespace nvme
+} // namespace phosphor
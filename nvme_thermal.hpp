@@ -0,0 +1,91 @@
+#pragma once
+
+#include "config.h"
+
+#include "nvmes.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <sdbusplus/bus.hpp>
+#include <sdbusplus/server.hpp>
+#include <sdbusplus/server/interface.hpp>
+#include <string>
+#include <vector>
+
+namespace phosphor
+{
+namespace nvme
+{
+
+using SummaryIfaces =
+    sdbusplus::server::object::object<ValueIface, AvailabilityInterface>;
+
+/** @class NvmeThermal
+ *  @brief Aggregated temperature of a group of drives.
+ *
+ *  Publishes the maximum and the mean temperature of the drives of the
+ *  group as sensors `<name>_max` and `<name>_mean`, and the index of the
+ *  hottest drive on the maximum sensor. Only drives with a valid reading
+ *  are counted; the sensors are unavailable while there is none.
+ */
+class NvmeThermal
+{
+  public:
+    NvmeThermal() = delete;
+    NvmeThermal(const NvmeThermal&) = delete;
+    NvmeThermal& operator=(const NvmeThermal&) = delete;
+    NvmeThermal(NvmeThermal&&) = delete;
+    NvmeThermal& operator=(NvmeThermal&&) = delete;
+
+    /** @brief Constructs NvmeThermal
+     *
+     * @param[in] bus     - Handle to system dbus
+     * @param[in] objPath - Object path prefix of the aggregate sensors
+     * @param[in] drives  - Indexes of the drives of the group
+     */
+    NvmeThermal(sdbusplus::bus::bus& bus, const std::string& objPath,
+                const std::vector<std::string>& drives);
+
+    /** @brief Update the temperature of a drive of the group
+     *
+     * @param[in] index - NVMe drive index
+     * @param[in] value - Temperature, empty if the drive has no valid
+     *                    reading
+     */
+    void update(const std::string& index, std::optional<int8_t> value);
+
+    /** @brief Emit InterfacesAdded for the aggregate sensors */
+    void announce();
+
+    /** @brief D-Bus getter of the ThermalSummary properties */
+    static int getProperty(sd_bus* bus, const char* path,
+                           const char* interface, const char* property,
+                           sd_bus_message* reply, void* context,
+                           sd_bus_error* error);
+
+  private:
+    /** @brief Recompute the aggregates and publish them */
+    void publish(bool skipSignal);
+
+    /** @brief Maximum temperature sensor */
+    std::unique_ptr<SummaryIfaces> maxSensor;
+    /** @brief Mean temperature sensor */
+    std::unique_ptr<SummaryIfaces> meanSensor;
+    /** @brief ThermalSummary interface on the maximum sensor */
+    sdbusplus::server::interface::interface summaryIface;
+
+    /** @brief Indexes of the drives of the group */
+    std::vector<std::string> drives;
+    /** @brief Valid temperatures of the drives, by position in drives */
+    std::vector<std::optional<int8_t>> temperatures;
+    /** @brief Sum of the valid temperatures */
+    int sum = 0;
+    /** @brief Number of valid temperatures */
+    uint32_t count = 0;
+    /** @brief Position of the hottest drive, if any */
+    std::optional<size_t> hottest;
+};
+
+} // namespace nvme
+} // namespace phosphor
@@ -0,0 +1,179 @@
+#include "nvme_tracer.hpp"
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <set>
+
+namespace phosphor
+{
+namespace nvme
+{
+
+NvmeTracer& NvmeTracer::get()
+{
+    static NvmeTracer tracer;
+    return tracer;
+}
+
+uint64_t NvmeTracer::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void NvmeTracer::enable(bool on)
+{
+    if (on && !enabled())
+    {
+        for (auto& event : events)
+        {
+            event.seq.store(0, std::memory_order_relaxed);
+        }
+        next.store(0, std::memory_order_relaxed);
+    }
+    isEnabled.store(on, std::memory_order_release);
+}
+
+void NvmeTracer::record(const char* name, const char* drive, uint32_t lane,
+                        uint64_t start, uint64_t end)
+{
+    auto pos = next.fetch_add(1, std::memory_order_relaxed);
+    auto& event = events[pos % capacity];
+
+    // The slot reads as invalid to a concurrent dump while it is written.
+    event.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    event.name = name;
+    event.drive = drive;
+    event.lane = lane;
+    event.start = start;
+    event.end = end;
+    event.seq.store(pos + 1, std::memory_order_release);
+}
+
+/** @brief Write a string as a JSON string literal */
+static void writeJsonString(FILE* file, const char* str)
+{
+    fputc('"', file);
+    for (; *str; ++str)
+    {
+        auto c = static_cast<unsigned char>(*str);
+        if (c == '"' || c == '\\')
+        {
+            fprintf(file, "\\%c", c);
+        }
+        else if (c < 0x20)
+        {
+            fprintf(file, "\\u%04x", c);
+        }
+        else
+        {
+            fputc(c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+std::string NvmeTracer::dump() const
+{
+    // A new file of its own, so that a caller can not have an existing
+    // file or a symbolic link overwritten.
+    char path[] = NVME_TRACE_DIR "/nvme-trace-XXXXXX.json";
+    int fd = mkstemps(path, strlen(".json"));
+    if (fd < 0)
+    {
+        return std::string();
+    }
+
+    FILE* file = fdopen(fd, "w");
+    if (!file)
+    {
+        auto err = errno;
+        close(fd);
+        unlink(path);
+        errno = err;
+        return std::string();
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    std::set<uint32_t> lanes;
+    const char* separator = "";
+
+    for (const auto& slot : events)
+    {
+        auto seq = slot.seq.load(std::memory_order_acquire);
+        if (!seq)
+        {
+            continue;
+        }
+
+        auto name = slot.name;
+        auto drive = slot.drive;
+        auto lane = slot.lane;
+        auto start = slot.start;
+        auto end = slot.end;
+
+        // Skip a slot that was rewritten while it was copied.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != seq)
+        {
+            continue;
+        }
+
+        lanes.insert(lane);
+        fprintf(file, "%s{\"name\":", separator);
+        writeJsonString(file, name);
+        fprintf(file,
+                ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,"
+                "\"dur\":%.3f",
+                lane, start / 1000.0, (end - start) / 1000.0);
+        if (drive)
+        {
+            fprintf(file, ",\"args\":{\"drive\":");
+            writeJsonString(file, drive);
+            fprintf(file, "}");
+        }
+        fprintf(file, "}");
+        separator = ",";
+    }
+
+    for (auto lane : lanes)
+    {
+        fprintf(file,
+                "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                "\"tid\":%u,\"args\":{\"name\":\"",
+                separator, lane);
+        if (lane == loopLane)
+        {
+            fprintf(file, "event loop\"}}");
+        }
+        else
+        {
+            fprintf(file, "i2c-%u\"}}", lane - 1);
+        }
+        separator = ",";
+    }
+
+    fprintf(file, "]}\n");
+
+    if (fclose(file) != 0)
+    {
+        auto err = errno;
+        unlink(path);
+        errno = err;
+        return std::string();
+    }
+
+    return path;
+}
+
+} // namespace nvme
+} // namespace phosphor
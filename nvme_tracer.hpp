@@ -0,0 +1,134 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace phosphor
+{
+namespace nvme
+{
+
+/** @class NvmeTracer
+ *  @brief Records spans of the poll cycle phases into a preallocated ring
+ *         and dumps them as a Chrome trace (Perfetto) JSON file.
+ *
+ *  Tracing is switched on and off at runtime. While it is off a span costs
+ *  one relaxed atomic load; while it is on, two clock reads and a slot
+ *  write, without locking or allocating. When the ring is full the oldest
+ *  spans are overwritten.
+ */
+class NvmeTracer
+{
+  public:
+    NvmeTracer(const NvmeTracer&) = delete;
+    NvmeTracer& operator=(const NvmeTracer&) = delete;
+    NvmeTracer(NvmeTracer&&) = delete;
+    NvmeTracer& operator=(NvmeTracer&&) = delete;
+
+    /** @brief Number of spans kept */
+    static constexpr size_t capacity = 4096;
+
+    /** @brief Lane of the spans recorded by the event loop */
+    static constexpr uint32_t loopLane = 0;
+
+    /** @brief Lane of the spans recorded by the worker of an I2C bus */
+    static constexpr uint32_t busLane(uint8_t busID)
+    {
+        return busID + 1;
+    }
+
+    /** @brief Get the process wide tracer */
+    static NvmeTracer& get();
+
+    /** @brief Switch tracing on or off, switching it on drops the spans
+     *         recorded before
+     */
+    void enable(bool on);
+
+    /** @brief Whether tracing is on */
+    bool enabled() const
+    {
+        return isEnabled.load(std::memory_order_relaxed);
+    }
+
+    /** @brief Time in nanoseconds on the std::chrono::steady_clock */
+    static uint64_t now();
+
+    /** @brief Record a span
+     *
+     * @param[in] name  - Phase name, must outlive the tracer
+     * @param[in] drive - Drive index, must outlive the tracer, or nullptr
+     * @param[in] lane  - Lane the span is shown in
+     * @param[in] start - Start of the span, from now()
+     * @param[in] end   - End of the span, from now()
+     */
+    void record(const char* name, const char* drive, uint32_t lane,
+                uint64_t start, uint64_t end);
+
+    /** @brief Write the recorded spans to a new Chrome trace JSON file in
+     *         NVME_TRACE_DIR
+     *
+     * @return Path of the file, empty with errno set if it could not be
+     *         written
+     */
+    std::string dump() const;
+
+    /** @class Span
+     *  @brief Records a span from its construction to its destruction.
+     */
+    class Span
+    {
+      public:
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+        Span(const char* name, const char* drive = nullptr,
+             uint32_t lane = loopLane) :
+            name(name),
+            drive(drive), lane(lane),
+            start(NvmeTracer::get().enabled() ? now() : 0)
+        {
+        }
+
+        ~Span()
+        {
+            if (start)
+            {
+                NvmeTracer::get().record(name, drive, lane, start, now());
+            }
+        }
+
+      private:
+        const char* name;
+        const char* drive;
+        uint32_t lane;
+        uint64_t start;
+    };
+
+  private:
+    NvmeTracer() = default;
+
+    /**
+     * Structure for keeping one span. seq is the position the slot was
+     * last written for plus one, and zero while it is being written.
+     */
+    struct Event
+    {
+        std::atomic<uint64_t> seq{0};
+        const char* name;
+        const char* drive;
+        uint32_t lane;
+        uint64_t start;
+        uint64_t end;
+    };
+
+    std::atomic<bool> isEnabled{false};
+    /** @brief Position of the next span */
+    std::atomic<uint64_t> next{0};
+    std::array<Event, capacity> events;
+};
+
+} // namespace nvme
+} // namespace phosphor
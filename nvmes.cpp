@@ -1,25 +1,79 @@
 #include "nvmes.hpp"
 
+#include <algorithm>
+
 namespace phosphor
 {
 namespace nvme
 {
 
+void NvmeSSD::stage(const char* interface, const char* property)
+{
+    auto entry = std::find_if(
+        staged.begin(), staged.end(),
+        [interface](const auto& e) { return e.first == interface; });
+    if (entry == staged.end())
+    {
+        staged.emplace_back(interface, std::vector<const char*>());
+        entry = staged.end() - 1;
+    }
+
+    auto& names = entry->second;
+    if (!names.empty())
+    {
+        names.pop_back();
+    }
+    names.push_back(property);
+    names.push_back(nullptr);
+}
+
+void NvmeSSD::commit()
+{
+    for (auto& [interface, names] : staged)
+    {
+        if (names.empty())
+        {
+            continue;
+        }
+
+        sd_bus_emit_properties_changed_strv(bus.get(), objPath.c_str(),
+                                            interface,
+                                            const_cast<char**>(names.data()));
+        names.clear();
+    }
+}
+
 void NvmeSSD::checkSensorThreshold()
 {
-    int8_t value = ValueIface::value();
-    int8_t criticalHigh = CriticalInterface::criticalHigh();
-    int8_t criticalLow = CriticalInterface::criticalLow();
-    int8_t warningHigh = WarningInterface::warningHigh();
-    int8_t warningLow = WarningInterface::warningLow();
+    double value = ValueIface::value();
+    bool criticalAlarmHigh = value > CriticalInterface::criticalHigh();
+    bool criticalAlarmLow = value < CriticalInterface::criticalLow();
+    bool warningAlarmHigh = value > WarningInterface::warningHigh();
+    bool warningAlarmLow = value < WarningInterface::warningLow();
 
-    CriticalInterface::criticalAlarmHigh(value > criticalHigh);
+    if (CriticalInterface::criticalAlarmHigh() != criticalAlarmHigh)
+    {
+        CriticalInterface::criticalAlarmHigh(criticalAlarmHigh, true);
+        stage(CriticalInterface::interface, "CriticalAlarmHigh");
+    }
 
-    CriticalInterface::criticalAlarmLow(value < criticalLow);
+    if (CriticalInterface::criticalAlarmLow() != criticalAlarmLow)
+    {
+        CriticalInterface::criticalAlarmLow(criticalAlarmLow, true);
+        stage(CriticalInterface::interface, "CriticalAlarmLow");
+    }
 
-    WarningInterface::warningAlarmHigh(value > warningHigh);
+    if (WarningInterface::warningAlarmHigh() != warningAlarmHigh)
+    {
+        WarningInterface::warningAlarmHigh(warningAlarmHigh, true);
+        stage(WarningInterface::interface, "WarningAlarmHigh");
+    }
 
-    WarningInterface::warningAlarmLow(value < warningLow);
+    if (WarningInterface::warningAlarmLow() != warningAlarmLow)
+    {
+        WarningInterface::warningAlarmLow(warningAlarmLow, true);
+        stage(WarningInterface::interface, "WarningAlarmLow");
+    }
 }
 
 void NvmeSSD::setSensorThreshold(int8_t criticalHigh, int8_t criticalLow,
@@ -39,7 +93,51 @@ void NvmeSSD::setSensorThreshold(int8_t criticalHigh, int8_t criticalLow,
 
 void NvmeSSD::setSensorValueToDbus(const int8_t value)
 {
-    ValueIface::value(value);
+    if (ValueIface::value() != value)
+    {
+        ValueIface::value(value, true);
+        stage(ValueIface::interface, "Value");
+    }
+}
+
+void NvmeSSD::setSensorAvailability(bool available)
+{
+    if (AvailabilityInterface::available() != available)
+    {
+        AvailabilityInterface::available(available, true);
+        stage(AvailabilityInterface::interface, "Available");
+    }
+}
+
+void NvmeSSD::setSensorFunctional(bool functional)
+{
+    if (OperationalStatusInterface::functional() != functional)
+    {
+        OperationalStatusInterface::functional(functional, true);
+        stage(OperationalStatusInterface::interface, "Functional");
+    }
+}
+
+void NvmeSSD::initSensor(int8_t value, int8_t criticalHigh, int8_t criticalLow,
+                         int8_t maxValue, int8_t minValue, int8_t warningHigh,
+                         int8_t warningLow, bool available)
+{
+    ValueIface::value(value, true);
+    ValueIface::maxValue(maxValue, true);
+    ValueIface::minValue(minValue, true);
+
+    CriticalInterface::criticalHigh(criticalHigh, true);
+    CriticalInterface::criticalLow(criticalLow, true);
+    CriticalInterface::criticalAlarmHigh(value > criticalHigh, true);
+    CriticalInterface::criticalAlarmLow(value < criticalLow, true);
+
+    WarningInterface::warningHigh(warningHigh, true);
+    WarningInterface::warningLow(warningLow, true);
+    WarningInterface::warningAlarmHigh(value > warningHigh, true);
+    WarningInterface::warningAlarmLow(value < warningLow, true);
+
+    AvailabilityInterface::available(available, true);
+    OperationalStatusInterface::functional(true, true);
 }
 
 } // namespace nvme
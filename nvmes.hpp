@@ -7,6 +7,11 @@
 #include <sdeventplus/clock.hpp>
 #include <sdeventplus/event.hpp>
 #include <sdeventplus/utility/timer.hpp>
+#include <string>
+#include <utility>
+#include <vector>
+#include <xyz/openbmc_project/State/Decorator/Availability/server.hpp>
+#include <xyz/openbmc_project/State/Decorator/OperationalStatus/server.hpp>
 #include <xyz/openbmc_project/Sensor/Threshold/Critical/server.hpp>
 #include <xyz/openbmc_project/Sensor/Threshold/Warning/server.hpp>
 #include <xyz/openbmc_project/Sensor/Value/server.hpp>
@@ -24,9 +29,16 @@ using CriticalInterface =
 using WarningInterface =
     sdbusplus::xyz::openbmc_project::Sensor::Threshold::server::Warning;
 
+using AvailabilityInterface =
+    sdbusplus::xyz::openbmc_project::State::Decorator::server::Availability;
+
+using OperationalStatusInterface = sdbusplus::xyz::openbmc_project::State::
+    Decorator::server::OperationalStatus;
+
 using NvmeIfaces =
     sdbusplus::server::object::object<ValueIface, CriticalInterface,
-                                      WarningInterface>;
+                                      WarningInterface, AvailabilityInterface,
+                                      OperationalStatusInterface>;
 
 class NvmeSSD : public NvmeIfaces
 {
@@ -39,12 +51,18 @@ class NvmeSSD : public NvmeIfaces
     virtual ~NvmeSSD() = default;
 
     /** @brief Constructs NvmeSSD
+     *
+     *  The object is not announced on D-Bus until emit_object_added() is
+     *  called, so that its initial properties can be set first.
+     *
+     *  The setters below only stage their changes; commit() emits them,
+     *  at most one PropertiesChanged per interface.
      *
      * @param[in] bus     - Handle to system dbus
      * @param[in] objPath - The Dbus path of nvme
      */
     NvmeSSD(sdbusplus::bus::bus& bus, const char* objPath) :
-        NvmeIfaces(bus, objPath), bus(bus)
+        NvmeIfaces(bus, objPath, true), bus(bus), objPath(objPath)
     {
     }
 
@@ -56,9 +74,32 @@ class NvmeSSD : public NvmeIfaces
     void setSensorThreshold(int8_t criticalHigh, int8_t criticalLow,
                             int8_t maxValue, int8_t minValue,
                             int8_t warningHigh, int8_t warningLow);
+    /** @brief Set whether the sensor value reflects a fresh reading */
+    void setSensorAvailability(bool available);
+    /** @brief Set whether the drive is functional */
+    void setSensorFunctional(bool functional);
+    /** @brief Set the initial properties before the object is announced,
+     *         without emitting PropertiesChanged signals
+     */
+    void initSensor(int8_t value, int8_t criticalHigh, int8_t criticalLow,
+                    int8_t maxValue, int8_t minValue, int8_t warningHigh,
+                    int8_t warningLow, bool available);
+    /** @brief Emit the staged property changes, one PropertiesChanged per
+     *         interface with only the properties that changed
+     */
+    void commit();
 
   private:
+    /** @brief Stage a changed property for commit() */
+    void stage(const char* interface, const char* property);
+
     sdbusplus::bus::bus& bus;
+    std::string objPath;
+    /** @brief Staged property names by interface, each list is terminated
+     *         by a nullptr once it is not empty; kept across commits so
+     *         that staging does not allocate
+     */
+    std::vector<std::pair<const char*, std::vector<const char*>>> staged;
 };
 } // namespace nvme
 } // namespace phosphor
\ No newline at end of file
@@ -1,10 +1,21 @@
-#include <iostream>
+#pragma once
+
+#include "nvme_log.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <functional>
 #include <phosphor-logging/elog-errors.hpp>
 #include <phosphor-logging/elog.hpp>
 #include <phosphor-logging/log.hpp>
 #include <sdbusplus/bus.hpp>
 #include <sdbusplus/bus/match.hpp>
 #include <sdbusplus/message.hpp>
+#include <string>
+#include <unordered_set>
+#include <vector>
 #include <xyz/openbmc_project/Common/error.hpp>
 
 namespace phosphor
@@ -14,87 +25,353 @@ namespace nvme
 namespace util
 {
 
+/** @brief D-Bus type of a property value the helpers get or set */
+template <typename T>
+struct DBusType;
+
+template <>
+struct DBusType<bool>
+{
+    static constexpr const char* signature = "b";
+
+    static int append(sd_bus_message* m, bool value)
+    {
+        int data = value;
+        return sd_bus_message_append_basic(m, 'b', &data);
+    }
+
+    static int read(sd_bus_message* m, bool& value)
+    {
+        int data = 0;
+        auto r = sd_bus_message_read_basic(m, 'b', &data);
+        value = data;
+        return r;
+    }
+};
+
+template <>
+struct DBusType<std::string>
+{
+    static constexpr const char* signature = "s";
+
+    static int append(sd_bus_message* m, const std::string& value)
+    {
+        return sd_bus_message_append_basic(m, 's', value.c_str());
+    }
+
+    static int read(sd_bus_message* m, std::string& value)
+    {
+        const char* data = nullptr;
+        auto r = sd_bus_message_read_basic(m, 's', &data);
+        if (r > 0)
+        {
+            value = data;
+        }
+        return r;
+    }
+};
+
+/** @class SDBusPlus
+ *  @brief Property and method helpers on the sd-bus API.
+ *
+ *  The helpers do not throw, a failure is logged and returned as a negative
+ *  errno. A call takes a Target whose strings were interned once, so it
+ *  neither copies a string nor builds a variant; sd-bus seals a message
+ *  when it is sent, so each call still needs its own message. Properties
+ *  are set and methods called through AsyncCalls.
+ */
 class SDBusPlus
 {
   public:
-    template <typename T>
-    static auto
-        setProperty(sdbusplus::bus::bus& bus, const std::string& busName,
-                    const std::string& objPath, const std::string& interface,
-                    const std::string& property, const T& value)
+    /**
+     * Structure for keeping an interface of a D-Bus object, the strings
+     * are interned and live until the process exits
+     */
+    struct Target
+    {
+        const char* busName = nullptr;
+        const char* objPath = nullptr;
+        const char* interface = nullptr;
+        const char* logKey = nullptr; /* Rate limiting key of the failures  */
+    };
+
+    /** @brief Intern the strings of a target, only called from the event
+     *         loop
+     *
+     * @param[in] busName   - Service name
+     * @param[in] objPath   - Object path
+     * @param[in] interface - Interface name
+     *
+     * @return Target of the interface
+     */
+    static Target target(const std::string& busName,
+                         const std::string& objPath,
+                         const std::string& interface)
     {
-        sdbusplus::message::variant<T> data = value;
+        return {intern(busName), intern(objPath), intern(interface),
+                intern(objPath + "-" + interface)};
+    }
+
+    /** @brief Get a property
+     *
+     * @param[out] value - Property value, unchanged on failure
+     *
+     * @return 0, or a negative errno on failure
+     */
+    template <typename Property>
+    static int getProperty(sdbusplus::bus::bus& bus, const Target& target,
+                           const char* property, Property& value) noexcept
+    {
+        sd_bus_message* reply = nullptr;
+        sd_bus_error error = SD_BUS_ERROR_NULL;
+
+        auto r = sd_bus_call_method(bus.get(), target.busName, target.objPath,
+                                    DBUS_PROPERTY_IFACE, "Get", &error,
+                                    &reply, "ss", target.interface, property);
+        if (r >= 0)
+        {
+            r = sd_bus_message_enter_container(reply, 'v',
+                                               DBusType<Property>::signature);
+        }
+        if (r >= 0)
+        {
+            Property data{};
+            r = DBusType<Property>::read(reply, data);
+            if (r > 0)
+            {
+                value = std::move(data);
+            }
+            else if (r == 0)
+            {
+                r = -EBADMSG;
+            }
+        }
+        sd_bus_message_unref(reply);
 
-        try
+        if (r < 0)
         {
-            auto methodCall = bus.new_method_call(
-                busName.c_str(), objPath.c_str(), DBUS_PROPERTY_IFACE, "Set");
+            logFailure("dbus-get-", "Get properties fail", target,
+                       "DBUS_PROPERTY", property, r, error);
+        }
+        sd_bus_error_free(&error);
 
-            methodCall.append(interface.c_str());
-            methodCall.append(property);
-            methodCall.append(data);
+        return r < 0 ? r : 0;
+    }
+
+  private:
+    friend class AsyncCalls;
 
-            auto reply = bus.call(methodCall);
+    /** @brief Build the message of a property Set
+     *
+     * @param[out] m - Message, to be unreferenced by the caller
+     *
+     * @return 0, or a negative errno on failure
+     */
+    template <typename T>
+    static int newSet(sdbusplus::bus::bus& bus, const Target& target,
+                      const char* property, const T& value,
+                      sd_bus_message*& m) noexcept
+    {
+        auto r = sd_bus_message_new_method_call(
+            bus.get(), &m, target.busName, target.objPath,
+            DBUS_PROPERTY_IFACE, "Set");
+        if (r >= 0)
+        {
+            r = sd_bus_message_append(m, "ss", target.interface, property);
         }
-        catch (const std::exception& e)
+        if (r >= 0)
         {
-            std::cerr << "Set properties fail. ERROR = " << e.what()
-                      << std::endl;
-            std::cerr << "Object path = " << objPath << std::endl;
-            return;
+            r = sd_bus_message_open_container(m, 'v', DBusType<T>::signature);
         }
+        if (r >= 0)
+        {
+            r = DBusType<T>::append(m, value);
+        }
+        if (r >= 0)
+        {
+            r = sd_bus_message_close_container(m);
+        }
+
+        return r < 0 ? r : 0;
     }
 
-    template <typename Property>
-    static auto
-        getProperty(sdbusplus::bus::bus& bus, const std::string& busName,
-                    const std::string& objPath, const std::string& interface,
-                    const std::string& property)
+    /** @brief Stable copy of a string, shared by equal strings */
+    static const char* intern(const std::string& str)
+    {
+        static std::unordered_set<std::string> strings;
+        return strings.insert(str).first->c_str();
+    }
+
+    /** @brief Log a failed call once, through the rate limited logger */
+    static void logFailure(const char* keyPrefix, const char* message,
+                           const Target& target, const char* memberField,
+                           const char* member, int r,
+                           const sd_bus_error& error)
     {
-        auto methodCall = bus.new_method_call(busName.c_str(), objPath.c_str(),
-                                              DBUS_PROPERTY_IFACE, "Get");
+        logError(std::string(keyPrefix) + target.logKey, message,
+                 {{"DBUS_PATH", target.objPath},
+                  {"DBUS_INTERFACE", target.interface},
+                  {memberField, member},
+                  {"ERROR", error.message ? error.message : strerror(-r)}});
+    }
+};
+
+/** @class AsyncCalls
+ *  @brief Property Sets and method calls that do not wait for their reply.
+ *
+ *  The replies are handled when the event loop dispatches them, so a slow or
+ *  hung peer does not stall the poll timer. The calls issued after begin()
+ *  form a round; done is called with whether a reply failed once the last
+ *  reply of the round arrived. A new round and the destructor cancel the
+ *  replies still pending, which are then neither logged nor reported.
+ */
+class AsyncCalls
+{
+  public:
+    /** @brief Called once every call of a round replied */
+    using Done = std::function<void(bool failed)>;
 
-        methodCall.append(interface.c_str());
-        methodCall.append(property);
+    AsyncCalls() = default;
+    AsyncCalls(const AsyncCalls&) = delete;
+    AsyncCalls& operator=(const AsyncCalls&) = delete;
+    AsyncCalls(AsyncCalls&&) = delete;
+    AsyncCalls& operator=(AsyncCalls&&) = delete;
 
-        sdbusplus::message::variant<Property> value;
+    ~AsyncCalls()
+    {
+        begin();
+    }
+
+    /** @brief Set the callback of a finished round */
+    void onDone(Done done)
+    {
+        this->done = std::move(done);
+    }
 
-        try
+    /** @brief Start a new round, cancelling the calls still pending */
+    void begin()
+    {
+        for (auto& call : calls)
         {
-            auto reply = bus.call(methodCall);
-            reply.read(value);
+            sd_bus_slot_unref(call.slot);
         }
-        catch (const std::exception& e)
+        calls.clear();
+        failed = false;
+    }
+
+    /** @brief Whether calls of the round are still pending */
+    bool pending() const
+    {
+        return !calls.empty();
+    }
+
+    /** @brief Send a property Set
+     *
+     * @return 0 if it was sent, or a negative errno on failure
+     */
+    template <typename T>
+    int setProperty(sdbusplus::bus::bus& bus,
+                    const SDBusPlus::Target& target, const char* property,
+                    const T& value) noexcept
+    {
+        sd_bus_message* m = nullptr;
+        Call call{nullptr, target, property, "dbus-set-",
+                  "Set properties fail", "DBUS_PROPERTY"};
+
+        auto r = SDBusPlus::newSet(bus, target, property, value, m);
+        if (r >= 0)
         {
-            std::cerr << "Get properties fail.. ERROR = " << e.what()
-                      << std::endl;
-            std::cerr << "Object path = " << objPath << std::endl;
-            return false;
+            r = send(bus, m, call);
         }
+        sd_bus_message_unref(m);
 
-        return sdbusplus::message::variant_ns::get<Property>(value);
+        return r;
     }
 
+    /** @brief Send a method call
+     *
+     * @return 0 if it was sent, or a negative errno on failure
+     */
     template <typename... Args>
-    static auto CallMethod(sdbusplus::bus::bus& bus, const std::string& busName,
-                           const std::string& objPath,
-                           const std::string& interface,
-                           const std::string& method, Args&&... args)
+    int callMethod(sdbusplus::bus::bus& bus, const SDBusPlus::Target& target,
+                   const char* method, Args&&... args)
     {
-        auto reqMsg = bus.new_method_call(busName.c_str(), objPath.c_str(),
-                                          interface.c_str(), method.c_str());
+        Call call{nullptr, target, method, "dbus-call-", "Call method fail",
+                  "DBUS_METHOD"};
+
+        auto reqMsg = bus.new_method_call(target.busName, target.objPath,
+                                          target.interface, method);
         reqMsg.append(std::forward<Args>(args)...);
-        try
+
+        return send(bus, reqMsg.get(), call);
+    }
+
+  private:
+    /** @brief A call whose reply is pending, with what its failure logs */
+    struct Call
+    {
+        sd_bus_slot* slot;
+        SDBusPlus::Target target;
+        const char* member;
+        const char* keyPrefix;
+        const char* message;
+        const char* memberField;
+    };
+
+    /** @brief Send a call and keep its reply slot */
+    int send(sdbusplus::bus::bus& bus, sd_bus_message* m, Call& call) noexcept
+    {
+        auto r = sd_bus_call_async(bus.get(), &call.slot, m, replied, this, 0);
+        if (r < 0)
+        {
+            sd_bus_error error = SD_BUS_ERROR_NULL;
+            SDBusPlus::logFailure(call.keyPrefix, call.message, call.target,
+                                  call.memberField, call.member, r, error);
+            return r;
+        }
+
+        calls.push_back(call);
+        return 0;
+    }
+
+    /** @brief Reply handler, finds the call by the slot being dispatched */
+    static int replied(sd_bus_message* reply, void* userdata,
+                       sd_bus_error* /*retError*/)
+    {
+        auto self = static_cast<AsyncCalls*>(userdata);
+        auto slot = sd_bus_get_current_slot(sd_bus_message_get_bus(reply));
+        auto call = std::find_if(
+            self->calls.begin(), self->calls.end(),
+            [slot](const Call& entry) { return entry.slot == slot; });
+        if (call == self->calls.end())
         {
-            auto respMsg = bus.call(reqMsg);
+            return 0;
         }
-        catch (const std::exception& e)
+
+        const sd_bus_error* error = sd_bus_message_get_error(reply);
+        if (error)
         {
-            std::cerr << "Call method fail. ERROR = " << e.what() << std::endl;
-            std::cerr << "Object path = " << objPath << std::endl;
-            return;
+            SDBusPlus::logFailure(call->keyPrefix, call->message, call->target,
+                                  call->memberField, call->member,
+                                  -sd_bus_message_get_errno(reply), *error);
+            self->failed = true;
         }
+
+        sd_bus_slot_unref(call->slot);
+        self->calls.erase(call);
+        if (self->calls.empty() && self->done)
+        {
+            self->done(self->failed);
+        }
+
+        return 0;
     }
+
+    Done done;
+    /** @brief Calls of the round whose reply is pending */
+    std::vector<Call> calls;
+    /** @brief Whether a reply of the round failed */
+    bool failed = false;
 };
 
 } // namespace util
@@ -1,5 +1,8 @@
 #include "smbus.hpp"
 
+#include "i2c_trace.hpp"
+#include "nvme_log.hpp"
+
 #include <errno.h>
 #include <fcntl.h>
 #include <stdint.h>
@@ -9,22 +12,24 @@
 #include <sys/ioctl.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <mutex>
 
 #include "i2c.h"
 
-#define MAX_I2C_BUS 30
 static constexpr bool DEBUG = false;
 
-static int fd[MAX_I2C_BUS] = {0};
+static int fd[phosphor::smbus::Smbus::maxBuses] = {0};
 
 namespace phosphor
 {
 namespace smbus
 {
 
-std::mutex gMutex;
+/* One lock per bus, so that a hung bus does not block the others */
+static std::mutex gMutex[Smbus::maxBuses];
 
 int phosphor::smbus::Smbus::openI2cDev(int i2cbus, char* filename, size_t size,
                                        int quiet)
@@ -72,55 +77,262 @@ int phosphor::smbus::Smbus::smbusInit(int smbus_num)
     int res = 0;
     char filename[20];
 
-    gMutex.lock();
+    if (!validBus(smbus_num))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    gMutex[smbus_num].lock();
+
+    auto& trace = I2cTrace::get();
+    if (trace.mode() == I2cTrace::Mode::Replay)
+    {
+        // Nothing to open, the transactions come from the trace.
+        fd[smbus_num] = -1;
+        res = trace.replayOpen(smbus_num);
+
+        gMutex[smbus_num].unlock();
+
+        return res;
+    }
 
     fd[smbus_num] = openI2cDev(smbus_num, filename, sizeof(filename), 0);
+    if (trace.mode() == I2cTrace::Mode::Record)
+    {
+        trace.recordOpen(smbus_num, fd[smbus_num] < 0 ? -1 : fd[smbus_num]);
+    }
+
     if (fd[smbus_num] < 0)
     {
-        gMutex.unlock();
+        gMutex[smbus_num].unlock();
 
         return -1;
     }
 
     res = fd[smbus_num];
 
-    gMutex.unlock();
+    gMutex[smbus_num].unlock();
+
+    return res;
+}
+
+int phosphor::smbus::Smbus::smbusSetTimeout(int smbus_num, uint32_t timeout,
+                                            uint32_t retries)
+{
+    int res = 0;
+
+    if (!validBus(smbus_num) || fd[smbus_num] < 0)
+    {
+        return res;
+    }
+
+    // I2C_TIMEOUT is in units of 10 ms
+    if (ioctl(fd[smbus_num], I2C_TIMEOUT, (timeout + 9) / 10) < 0 ||
+        ioctl(fd[smbus_num], I2C_RETRIES, retries) < 0)
+    {
+        res = -1;
+    }
 
     return res;
 }
 
 void phosphor::smbus::Smbus::smbusClose(int smbus_num)
 {
-    close(fd[smbus_num]);
+    if (validBus(smbus_num) && fd[smbus_num] >= 0)
+    {
+        close(fd[smbus_num]);
+    }
+}
+
+/** @brief Update the SMBus PEC, a CRC-8 with polynomial x^8 + x^2 + x + 1 */
+static uint8_t pecUpdate(uint8_t crc, uint8_t data)
+{
+    crc ^= data;
+    for (int bit = 0; bit < 8; ++bit)
+    {
+        crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+
+    return crc;
+}
+
+int phosphor::smbus::Smbus::SendSmbusRWBlockCmdsRAW(int smbus_num,
+                                                    BlockRead* reads,
+                                                    size_t count, bool pec)
+{
+    int res;
+    i2c_msg msgs[maxBatchReads * 2];
+
+    if (!validBus(smbus_num) || count == 0 || count > maxBatchReads)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> lock(gMutex[smbus_num]);
+
+    auto& trace = I2cTrace::get();
+    if (trace.mode() == I2cTrace::Mode::Replay)
+    {
+        // The trace holds every read of the batch as its own transaction.
+        res = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto& read = reads[i];
+            read.rsp[0] = 1 + pec;
+            read.result = trace.replayTransfer(smbus_num, read.address,
+                                               read.tx, read.txLen, read.rsp);
+            res = std::min(res, read.result);
+        }
+        return res;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto& read = reads[i];
+        // The bytes read after the block: its length and the PEC.
+        read.rsp[0] = 1 + pec;
+
+        msgs[i * 2].addr = read.address & 0xFF;
+        msgs[i * 2].flags = 0;
+        msgs[i * 2].buf = read.tx;
+        msgs[i * 2].len = read.txLen;
+
+        msgs[i * 2 + 1].addr = read.address & 0xFF;
+        msgs[i * 2 + 1].flags = I2C_M_RD | I2C_M_RECV_LEN;
+        msgs[i * 2 + 1].buf = read.rsp;
+        msgs[i * 2 + 1].len = I2C_DATA_MAX;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    res = i2c_rdwr(fd[smbus_num], msgs, count * 2);
+    auto err = errno;
+    auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto& read = reads[i];
+
+        read.result = (res < 0) ? res : 2;
+        if (res < 0)
+        {
+            read.rsp[0] = 0;
+        }
+
+        if (trace.mode() == I2cTrace::Mode::Record)
+        {
+            trace.recordTransfer(
+                smbus_num, read.address, read.tx, read.txLen, read.rsp,
+                std::min(read.rsp[0] + 1 + pec, I2C_DATA_MAX), read.result,
+                latency / count);
+        }
+    }
+
+    if (res < 0)
+    {
+        phosphor::nvme::logError(
+            "smbus-rw-" + std::to_string(smbus_num),
+            "SendSmbusRWBlockCmdsRAW failed",
+            {{"I2C_BUS", std::to_string(smbus_num)},
+             {"READS", std::to_string(count)},
+             {"ERROR", strerror(err)}});
+    }
+    errno = err;
+
+    return res;
+}
+
+bool phosphor::smbus::Smbus::checkBlockReadPec(int8_t device_addr,
+                                               const uint8_t* tx_data,
+                                               uint8_t tx_len,
+                                               const uint8_t* rsp_data)
+{
+    if (rsp_data[0] + 1 >= I2C_DATA_MAX)
+    {
+        return false;
+    }
+
+    uint8_t address = device_addr & 0x7f;
+    uint8_t crc = pecUpdate(0, address << 1);
+
+    for (uint8_t i = 0; i < tx_len; ++i)
+    {
+        crc = pecUpdate(crc, tx_data[i]);
+    }
+
+    // Repeated start with the read address, then the length and the block.
+    crc = pecUpdate(crc, (address << 1) | 1);
+    for (int i = 0; i <= rsp_data[0]; ++i)
+    {
+        crc = pecUpdate(crc, rsp_data[i]);
+    }
+
+    return crc == rsp_data[rsp_data[0] + 1];
 }
 
 int phosphor::smbus::Smbus::SendSmbusRWBlockCmdRAW(int smbus_num,
                                                    int8_t device_addr,
                                                    uint8_t* tx_data,
                                                    uint8_t tx_len,
-                                                   uint8_t* rsp_data)
+                                                   uint8_t* rsp_data, bool pec)
 {
     int res, res_len;
     unsigned char Rx_buf[I2C_DATA_MAX] = {0};
 
-    Rx_buf[0] = 1;
+    Rx_buf[0] = 1 + pec;
 
-    gMutex.lock();
+    if (!validBus(smbus_num))
+    {
+        errno = EINVAL;
+        return -1;
+    }
 
-    res = i2c_read_after_write(fd[smbus_num], device_addr, tx_len,
-                               (unsigned char*)tx_data, I2C_DATA_MAX,
-                               (unsigned char*)Rx_buf);
+    gMutex[smbus_num].lock();
 
-    if (res < 0)
+    auto& trace = I2cTrace::get();
+    if (trace.mode() == I2cTrace::Mode::Replay)
     {
-        fprintf(stderr, "Error: SendSmbusRWBlockCmdRAW failed\n");
+        res = trace.replayTransfer(smbus_num, device_addr, tx_data, tx_len,
+                                   Rx_buf);
     }
+    else
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        res = i2c_read_after_write(fd[smbus_num], device_addr, tx_len,
+                                   (unsigned char*)tx_data, I2C_DATA_MAX,
+                                   (unsigned char*)Rx_buf);
 
-    res_len = Rx_buf[0] + 1;
+        if (trace.mode() == I2cTrace::Mode::Record)
+        {
+            auto err = errno;
+            trace.recordTransfer(
+                smbus_num, device_addr, tx_data, tx_len, Rx_buf,
+                std::min(Rx_buf[0] + 1 + pec, I2C_DATA_MAX), res,
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start));
+            errno = err;
+        }
+    }
+    auto err = errno;
+
+    res_len = std::min(Rx_buf[0] + 1 + pec, I2C_DATA_MAX);
 
     memcpy(rsp_data, Rx_buf, res_len);
 
-    gMutex.unlock();
+    gMutex[smbus_num].unlock();
+
+    if (res < 0)
+    {
+        phosphor::nvme::logError(
+            "smbus-rw-" + std::to_string(smbus_num),
+            "SendSmbusRWBlockCmdRAW failed",
+            {{"I2C_BUS", std::to_string(smbus_num)},
+             {"I2C_ADDRESS", std::to_string(device_addr)},
+             {"ERROR", strerror(err)}});
+    }
 
     return res;
 }
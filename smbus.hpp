@@ -19,15 +19,89 @@ class Smbus
   public:
     Smbus(){};
 
+    /**
+     * Structure for keeping one block read of a batch
+     */
+    struct BlockRead
+    {
+        uint8_t address; /* I2C slave address  */
+        uint8_t* tx;     /* Bytes to write  */
+        uint8_t txLen;   /* Number of bytes to write  */
+        uint8_t* rsp;    /* Response, I2C_DATA_MAX bytes  */
+        int result;      /* Result, negative on failure  */
+    };
+
+    /** @brief Most block reads run by one SendSmbusRWBlockCmdsRAW() */
+    static constexpr size_t maxBatchReads = 21;
+
+    /** @brief I2C bus numbers below this one can be used */
+    static constexpr int maxBuses = 30;
+
+    /** @brief Whether an I2C bus number can be used */
+    static constexpr bool validBus(int smbus_num)
+    {
+        return smbus_num >= 0 && smbus_num < maxBuses;
+    }
+
     int openI2cDev(int i2cbus, char* filename, size_t size, int quiet);
 
     int smbusInit(int smbus_num);
 
+    /** @brief Set the adapter timeout and retries of an opened bus
+     *
+     * @param[in] smbus_num - I2C bus number
+     * @param[in] timeout   - Adapter timeout in milliseconds
+     * @param[in] retries   - Adapter retries
+     *
+     * @return 0 on success, -1 on failure
+     */
+    int smbusSetTimeout(int smbus_num, uint32_t timeout, uint32_t retries);
+
     void smbusClose(int smbus_num);
 
+    /** @brief Write bytes and block read the response
+     *
+     * @param[in]  smbus_num   - I2C bus number
+     * @param[in]  device_addr - I2C slave address
+     * @param[in]  tx_data     - Bytes to write
+     * @param[in]  tx_len      - Number of bytes to write
+     * @param[out] rsp_data    - Block length followed by the block, and
+     *                           the PEC byte if pec is set
+     * @param[in]  pec         - Whether to also read the PEC byte
+     *
+     * @return Negative on failure
+     */
     int SendSmbusRWBlockCmdRAW(int smbus_num, int8_t device_addr,
                                uint8_t* tx_data, uint8_t tx_len,
-                               uint8_t* rsp_data);
+                               uint8_t* rsp_data, bool pec = false);
+
+    /** @brief Write bytes and block read the response of several
+     *         devices in one I2C_RDWR transfer
+     *
+     * A failed transfer fails every read of the batch, the reads can then
+     * be repeated one by one with SendSmbusRWBlockCmdRAW().
+     *
+     * @param[in]     smbus_num - I2C bus number
+     * @param[in,out] reads     - Block reads, at most maxBatchReads
+     * @param[in]     count     - Number of block reads
+     * @param[in]     pec       - Whether to also read the PEC bytes
+     *
+     * @return Negative on failure
+     */
+    int SendSmbusRWBlockCmdsRAW(int smbus_num, BlockRead* reads, size_t count,
+                                bool pec = false);
+
+    /** @brief Check the PEC byte of a block read response
+     *
+     * @param[in] device_addr - I2C slave address
+     * @param[in] tx_data     - Bytes written before the read
+     * @param[in] tx_len      - Number of bytes written
+     * @param[in] rsp_data    - Block length, block and PEC byte
+     *
+     * @return Whether the PEC byte matches the transaction
+     */
+    static bool checkBlockReadPec(int8_t device_addr, const uint8_t* tx_data,
+                                  uint8_t tx_len, const uint8_t* rsp_data);
 };
 
 } // namespace smbus
@@ -0,0 +1,545 @@
+#include "i2c_trace.hpp"
+#include "nvme_manager.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sdbusplus/bus.hpp>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <systemd/sd-bus.h>
+#include <systemd/sd-event.h>
+#include <unistd.h>
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t nmemb, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+
+/* Heap allocations of all threads, operator new allocates through malloc */
+static std::atomic<size_t> allocations{0};
+
+extern "C" void* malloc(size_t size) noexcept
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t nmemb, size_t size) noexcept
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(nmemb, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size) noexcept
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+namespace
+{
+
+namespace fs = std::filesystem;
+using phosphor::smbus::I2cTrace;
+
+constexpr uint8_t busID = 16;
+constexpr uint8_t address = 0x6a;
+constexpr int presentPin = 148;
+constexpr int pwrGoodPin = 161;
+
+/* Cycles that create the sensor and grow the reused buffers */
+constexpr size_t warmupCycles = 5;
+/* Cycles that must not allocate */
+constexpr size_t measuredCycles = 20;
+/* Cycles after the measured ones, the end of the replay is logged */
+constexpr size_t tailCycles = 2;
+/* Accesses of a cycle: two GPIO reads, the bus open and two block reads */
+constexpr size_t accessesPerCycle = 5;
+
+std::string gpioPath(int pin)
+{
+    return "/sys/class/gpio/gpio" + std::to_string(pin) + "/value";
+}
+
+constexpr auto faultLedGroupPath =
+    "/xyz/openbmc_project/led/groups/nvme0_fault";
+constexpr auto locateLedGroupPath =
+    "/xyz/openbmc_project/led/groups/nvme0_locate";
+constexpr auto locateLedBusName = "xyz.openbmc_project.LED.Controller.nvme0";
+constexpr auto locateLedPath = "/xyz/openbmc_project/led/physical/nvme0";
+
+/** @brief Write the config of one drive; in remote mode the drive also has
+ *         fault and locate LEDs
+ */
+void writeConfig(const std::string& path, bool remote,
+                 const std::string& layout = "basic")
+{
+    std::ofstream file(path);
+    file << R"({
+    "config": [
+        {
+            "NVMeDriveIndex": 0,
+            "NVMeDriveBusID": )"
+         << static_cast<int>(busID) << R"(,
+            "NVMeDrivePresentPin": )"
+         << presentPin << R"(,
+            "NVMeDrivePwrGoodPin": )"
+         << pwrGoodPin << R"(,
+            "NVMeDriveLayout": ")"
+         << layout << R"(")";
+    if (remote)
+    {
+        file << R"(,
+            "NVMeDriveFaultLEDGroupPath": ")"
+             << faultLedGroupPath << R"(",
+            "NVMeDriveLocateLEDGroupPath": ")"
+             << locateLedGroupPath << R"(",
+            "NVMeDriveLocateLEDControllerBusName": ")"
+             << locateLedBusName << R"(",
+            "NVMeDriveLocateLEDControllerPath": ")"
+             << locateLedPath << R"(")";
+    }
+    file << R"(
+        }
+    ],
+    "threshold": [
+        {
+            "criticalHigh": 80,
+            "criticalLow": 0,
+            "warningHigh": 70,
+            "warningLow": 5,
+            "maxValue": 127,
+            "minValue": -128
+        }
+    ],
+    "polling": {
+        "interval": 1000,
+        "powerOffInterval": 0
+    },
+    "inventory": {
+        "mode": ")"
+         << (remote ? "remote" : "local") << R"("
+    }
+})";
+}
+
+/** @brief Record a trace of a present, powered drive that never changes
+ *
+ * @param[in] path    - Trace file
+ * @param[in] readVpd - Whether the vendor ID and serial number block is read
+ */
+bool recordTrace(const std::string& path, bool readVpd = true)
+{
+    auto& trace = I2cTrace::get();
+    if (!trace.startRecording(path))
+    {
+        return false;
+    }
+
+    uint8_t statusCode = 0;
+    uint8_t vpdCode = 8;
+    // Status flags, SMART warnings, temperature and drive life used
+    std::array<uint8_t, 7> status = {6, 0xbf, 0xff, 35, 10, 0, 0};
+    // Vendor ID and serial number
+    std::array<uint8_t, 23> vpd = {22,  0x14, 0x4d, 'S', 'N', '0', '1', '2',
+                                   '3', '4',  '5',  '6', '7', '8', '9', ' ',
+                                   ' ', ' ',  ' ',  ' ', ' ', ' ', ' '};
+
+    for (size_t cycle = 0; cycle < warmupCycles + measuredCycles + tailCycles;
+         ++cycle)
+    {
+        trace.recordGpio(gpioPath(presentPin), "0");
+        trace.recordGpio(gpioPath(pwrGoodPin), "1");
+        trace.recordOpen(busID, 3);
+        trace.recordTransfer(busID, address, &statusCode, 1, status.data(),
+                             status.size(), status.size(),
+                             std::chrono::microseconds(0));
+        if (readVpd)
+        {
+            trace.recordTransfer(busID, address, &vpdCode, 1, vpd.data(),
+                                 vpd.size(), vpd.size(),
+                                 std::chrono::microseconds(0));
+        }
+    }
+    trace.flush();
+
+    return true;
+}
+
+/** @class PrivateBus
+ *  @brief dbus-daemon of the test, so that it needs no system bus
+ */
+class PrivateBus
+{
+  public:
+    PrivateBus()
+    {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) < 0)
+        {
+            return;
+        }
+
+        pid = fork();
+        if (pid == 0)
+        {
+            dup2(fds[1], STDOUT_FILENO);
+            execlp("dbus-daemon", "dbus-daemon", "--session", "--nofork",
+                   "--print-address", nullptr);
+            _exit(127);
+        }
+        close(fds[1]);
+
+        // The address is printed as one line once the daemon listens.
+        char c;
+        while (pid > 0 && read(fds[0], &c, 1) == 1 && c != '\n')
+        {
+            address += c;
+        }
+        close(fds[0]);
+    }
+
+    PrivateBus(const PrivateBus&) = delete;
+    PrivateBus& operator=(const PrivateBus&) = delete;
+
+    ~PrivateBus()
+    {
+        if (pid > 0)
+        {
+            kill(pid, SIGTERM);
+            waitpid(pid, nullptr, 0);
+        }
+    }
+
+    /** @brief Open a connection to the daemon
+     *
+     * @return The connection, or nullptr on failure
+     */
+    sd_bus* connect() const
+    {
+        sd_bus* b = nullptr;
+        if (address.empty() || sd_bus_new(&b) < 0)
+        {
+            return nullptr;
+        }
+        if (sd_bus_set_address(b, address.c_str()) < 0 ||
+            sd_bus_set_bus_client(b, 1) < 0 || sd_bus_start(b) < 0)
+        {
+            sd_bus_unref(b);
+            return nullptr;
+        }
+        return b;
+    }
+
+  private:
+    pid_t pid = -1;
+    std::string address;
+};
+
+/** @class FakeServices
+ *  @brief Inventory Manager and LED services that record the properties
+ *         set on them. They run on a connection and thread of their own,
+ *         as the service reads the Identify LED state with a blocking call.
+ */
+class FakeServices
+{
+  public:
+    /** @brief Take over a connection and own the service names on it */
+    FakeServices(sd_bus* bus) : bus(bus)
+    {
+        for (auto name : {INVENTORY_BUSNAME, LED_GROUP_BUSNAME,
+                          locateLedBusName})
+        {
+            if (sd_bus_request_name(bus, name, 0) < 0)
+            {
+                return;
+            }
+        }
+        if (sd_bus_add_fallback(bus, nullptr, "/xyz/openbmc_project", handle,
+                                this) < 0)
+        {
+            return;
+        }
+
+        thread = std::thread([this] {
+            while (!stop)
+            {
+                if (sd_bus_process(this->bus, nullptr) == 0)
+                {
+                    sd_bus_wait(this->bus, 100000);
+                }
+            }
+        });
+    }
+
+    FakeServices(const FakeServices&) = delete;
+    FakeServices& operator=(const FakeServices&) = delete;
+
+    ~FakeServices()
+    {
+        stop = true;
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+        sd_bus_flush_close_unref(bus);
+    }
+
+    /** @brief Whether the names are owned and the services run */
+    bool running() const
+    {
+        return thread.joinable();
+    }
+
+    /** @brief Wait until a property was set to a value
+     *
+     * @return The last value set, or an empty string if none was
+     */
+    std::string waitFor(const std::string& path, const std::string& interface,
+                        const std::string& property, const std::string& value)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto key = path + " " + interface + " " + property;
+        changed.wait_for(lock, std::chrono::seconds(5), [&] {
+            auto set = properties.find(key);
+            return set != properties.end() && set->second == value;
+        });
+
+        auto set = properties.find(key);
+        return set == properties.end() ? "" : set->second;
+    }
+
+  private:
+    /** @brief Answer a method call: record a Set, report false for a Get
+     *         and accept any other call
+     */
+    static int handle(sd_bus_message* m, void* userdata,
+                      sd_bus_error* /*retError*/)
+    {
+        auto self = static_cast<FakeServices*>(userdata);
+
+        if (sd_bus_message_is_method_call(m, DBUS_PROPERTY_IFACE, "Get"))
+        {
+            return sd_bus_reply_method_return(m, "v", "b", 0);
+        }
+
+        if (sd_bus_message_is_method_call(m, DBUS_PROPERTY_IFACE, "Set"))
+        {
+            const char* interface = nullptr;
+            const char* property = nullptr;
+            char type = 0;
+            const char* contents = nullptr;
+            std::string value;
+
+            if (sd_bus_message_read(m, "ss", &interface, &property) < 0 ||
+                sd_bus_message_peek_type(m, &type, &contents) < 0 ||
+                sd_bus_message_enter_container(m, 'v', contents) < 0)
+            {
+                return -EINVAL;
+            }
+            if (strcmp(contents, "b") == 0)
+            {
+                int data = 0;
+                sd_bus_message_read_basic(m, 'b', &data);
+                value = data ? "true" : "false";
+            }
+            else if (strcmp(contents, "s") == 0)
+            {
+                const char* data = nullptr;
+                sd_bus_message_read_basic(m, 's', &data);
+                value = data;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(self->mutex);
+                self->properties[std::string(sd_bus_message_get_path(m)) +
+                                 " " + interface + " " + property] = value;
+            }
+            self->changed.notify_all();
+        }
+
+        return sd_bus_reply_method_return(m, nullptr);
+    }
+
+    sd_bus* bus;
+    std::atomic<bool> stop{false};
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable changed;
+    /** @brief Values set by object path, interface and property name */
+    std::map<std::string, std::string> properties;
+};
+
+/** @class PollAllocations
+ *  @brief Runs the service against a replayed trace on a private bus
+ */
+class PollAllocations : public ::testing::Test
+{
+  protected:
+    void SetUp() override
+    {
+        char dirTemplate[] = "/tmp/nvme-poll-XXXXXX";
+        ASSERT_NE(mkdtemp(dirTemplate), nullptr);
+        dir = dirTemplate;
+
+        auto b = daemon.connect();
+        ASSERT_NE(b, nullptr) << "Can not start a private dbus-daemon";
+        bus.emplace(b, std::false_type());
+
+        ASSERT_GE(sd_event_default(&event), 0);
+        ASSERT_NE(sd_event_get_state(event), SD_EVENT_FINISHED);
+        bus->attach_event(event, SD_EVENT_PRIORITY_NORMAL);
+    }
+
+    void TearDown() override
+    {
+        if (bus)
+        {
+            bus->detach_event();
+            bus.reset();
+        }
+        if (event)
+        {
+            sd_event_unref(event);
+        }
+        fs::remove_all(dir);
+    }
+
+    /** @brief Record a trace and start replaying it
+     *
+     * @param[in] readVpd - Whether the vendor ID and serial number block is
+     *                      read
+     */
+    void startReplay(bool readVpd = true)
+    {
+        ASSERT_TRUE(recordTrace(dir + "/poll.trace", readVpd));
+        ASSERT_TRUE(I2cTrace::get().startReplay(dir + "/poll.trace", 20));
+    }
+
+    /** @brief Run the event loop until the replay ends it
+     *
+     * @param[in] cycle - Called after each event loop iteration
+     */
+    template <typename Cycle>
+    void runReplay(Cycle cycle)
+    {
+        while (sd_event_get_state(event) != SD_EVENT_FINISHED &&
+               sd_event_run(event, UINT64_MAX) >= 0)
+        {
+            cycle();
+        }
+    }
+
+    PrivateBus daemon;
+    std::optional<sdbusplus::bus::bus> bus;
+    sd_event* event = nullptr;
+    std::string dir;
+};
+
+} // namespace
+
+TEST_F(PollAllocations, SteadyStateCycleDoesNotAllocate)
+{
+    writeConfig(dir + "/nvme_config.json", false);
+    ASSERT_NO_FATAL_FAILURE(startReplay());
+
+    phosphor::nvme::Nvme nvme(*bus, dir + "/nvme_config.json",
+                              dir + "/snapshot.bin");
+    nvme.run();
+
+    auto& trace = I2cTrace::get();
+    std::optional<size_t> before;
+    std::optional<size_t> after;
+    runReplay([&] {
+        auto replayed = trace.replayed();
+        if (!before && replayed >= warmupCycles * accessesPerCycle)
+        {
+            before = allocations.load();
+        }
+        if (!after &&
+            replayed >= (warmupCycles + measuredCycles) * accessesPerCycle)
+        {
+            after = allocations.load();
+        }
+    });
+
+    ASSERT_TRUE(before && after);
+    EXPECT_EQ(*after - *before, 0u);
+    EXPECT_EQ(trace.unmatched(), 0u);
+}
+
+TEST_F(PollAllocations, RemoteModePublishesInventoryAndLeds)
+{
+    FakeServices services(daemon.connect());
+    ASSERT_TRUE(services.running());
+
+    writeConfig(dir + "/nvme_config.json", true);
+    ASSERT_NO_FATAL_FAILURE(startReplay());
+
+    phosphor::nvme::Nvme nvme(*bus, dir + "/nvme_config.json",
+                              dir + "/snapshot.bin");
+    nvme.run();
+    runReplay([] {});
+
+    EXPECT_EQ(I2cTrace::get().unmatched(), 0u);
+
+    std::string inventoryPath = NVME_INVENTORY_PATH "0";
+    EXPECT_EQ(services.waitFor(inventoryPath, ITEM_IFACE, "Present", "true"),
+              "true");
+    EXPECT_EQ(services.waitFor(inventoryPath, ASSET_IFACE, "Manufacturer",
+                               "14 4d"),
+              "14 4d");
+    EXPECT_EQ(services.waitFor(inventoryPath, NVME_STATUS_IFACE,
+                               "SmartWarnings", "ff"),
+              "ff");
+
+    // No SMART warning: the fault LED is off and the locate LED on.
+    EXPECT_EQ(services.waitFor(faultLedGroupPath, LED_GROUP_IFACE, "Asserted",
+                               "false"),
+              "false");
+    EXPECT_EQ(services.waitFor(locateLedPath, LED_CONTROLLER_IFACE, "State",
+                               "xyz.openbmc_project.Led.Physical.Action.On"),
+              "xyz.openbmc_project.Led.Physical.Action.On");
+}
+
+TEST_F(PollAllocations, StatusLayoutReadsOnlyTheStatusBlock)
+{
+    FakeServices services(daemon.connect());
+    ASSERT_TRUE(services.running());
+
+    // A read of the vendor ID block would be missing from the trace and
+    // fail the drive.
+    writeConfig(dir + "/nvme_config.json", true, "status");
+    ASSERT_NO_FATAL_FAILURE(startReplay(false));
+
+    phosphor::nvme::Nvme nvme(*bus, dir + "/nvme_config.json",
+                              dir + "/snapshot.bin");
+    nvme.run();
+    runReplay([] {});
+
+    EXPECT_EQ(I2cTrace::get().unmatched(), 0u);
+
+    std::string inventoryPath = NVME_INVENTORY_PATH "0";
+    EXPECT_EQ(services.waitFor(inventoryPath, ITEM_IFACE, "Present", "true"),
+              "true");
+    EXPECT_EQ(services.waitFor(inventoryPath, NVME_STATUS_IFACE,
+                               "SmartWarnings", "ff"),
+              "ff");
+    EXPECT_EQ(
+        services.waitFor(inventoryPath, ASSET_IFACE, "Manufacturer", ""), "");
+}